@@ -10,18 +10,26 @@
 
 #pragma once
 
+#include <array>
+
 #include "Memory.h"
+#include "BlockCache.h"
+#include "Jit.h"
+#include "IdleLoop.h"
+#include "Fastmem.h"
 #include "util.h"
 #include "PPU.h"
 #include "APU.h"
 #include "mmio.h"
+#include "Scheduler.h"
 
 class Arm7
 {
 public:
-    Arm7(Memory *mem);
+    Arm7(Memory *mem, Scheduler *scheduler);
     
     Memory *mem;
+    Scheduler *scheduler;
 
     struct instruction
     {
@@ -56,23 +64,18 @@ public:
 
     struct registers
     {
-        // general purpose registers
-        u32 r0;
-        u32 r1;
-        u32 r2;
-        u32 r3;
-        u32 r4;
-        u32 r5;
-        u32 r6;
-        u32 r7;
-        u32 r8;
-        u32 r9;
-        u32 r10;
-        u32 r11;
-        u32 r12;
-        u32 r13;
-        u32 r14; // subroutine link registers
-        u32 r15; // program counter
+        // registers of the current mode, r14 is the link register and r15 the program counter
+        // banked registers are swapped in and out when the mode changes, see Arm7::switchBank
+        u32 r[16];
+
+        // user / system registers, while in another mode
+        u32 r8_usr;
+        u32 r9_usr;
+        u32 r10_usr;
+        u32 r11_usr;
+        u32 r12_usr;
+        u32 r13_usr;
+        u32 r14_usr;
 
         // fiq registers
         u32 r8_fiq;
@@ -111,10 +114,29 @@ public:
     void decode();
     int  execute(u32);
 
+    // interpret until the scheduler reaches deadline or an event or interrupt needs handling
+    int  runUntil(u64);
+
+    // cached interpreter
+    BlockCache block_cache;
+    int runBlock(int);
+
+    // run blocks as native code instead, see Jit
+    bool jit_enabled;
+
+    // busy-wait loops that are skipped up to the next event
+    IdleLoopDetector idle_loops;
+
+    // map guest memory into host virtual memory, see Fastmem
+    bool fastmem_enabled;
+    bool enableFastmem();
+
     void tick(u8, u8, u8);
+    void tickData(u32, bool, u8, u8);
 
-    u32  getRegister(u32);
-    void setRegister(u32, u32);
+    // r0 - r15 are read straight from the register file, cpsr and spsr need the mode
+    u32  getRegister(u32 reg)          { return reg <= r15 ? registers.r[reg] : getStatusRegister(reg); }
+    void setRegister(u32 reg, u32 val) { if (reg <= r15) registers.r[reg] = val; else setStatusRegister(reg, val); }
 
     // instruction execution
     void branchExchange(u32);
@@ -128,27 +150,38 @@ public:
     void blockDataTransfer(u32);
     void singleDataSwap(u32);
     void softwareInterruptArm(u32);
+    void undefinedArm(u32);
+
+    // arm handlers, indexed by bits 27-20 and 7-4 of an instruction
+    using ArmHandler = void (Arm7::*)(u32);
+    static const std::array<ArmHandler, 4096> arm_lut;
 
     // thumb instructions
-    void moveShiftedRegister(u16);
-    void addSubtract(u16);
-    void moveImmediate(u16);
-    void aluThumb(u16);
-    void hiRegisterOps(u16);
-    void pcRelLoad(u16);
-    void loadStoreRegOffset(u16);
-    void loadStoreSignedHalfword(u16);
-    void loadStoreImmediate(u16);
-    void loadStoreHalfword(u16);
-    void spRelLoadStore(u16);
-    void loadAddress(u16);
-    void addOffsetToSp(u16);
-    void pushPop(u16);
-    void multipleLoadStore(u16);
-    void conditionalBranch(u16);
+    // fields held in the top 10 bits of the instruction are template arguments, see thumb_lut
+    template <u8, u8>         void moveShiftedRegister(u16);
+    template <bool, bool, u8> void addSubtract(u16);
+    template <u8, u8>         void moveImmediate(u16);
+    template <u8>             void aluThumb(u16);
+    template <u8, bool, bool> void hiRegisterOps(u16);
+    template <u8>             void pcRelLoad(u16);
+    template <bool, bool, u8> void loadStoreRegOffset(u16);
+    template <bool, bool, u8> void loadStoreSignedHalfword(u16);
+    template <bool, bool, u8> void loadStoreImmediate(u16);
+    template <bool, u8>       void loadStoreHalfword(u16);
+    template <bool, u8>       void spRelLoadStore(u16);
+    template <bool, u8>       void loadAddress(u16);
+    template <bool>           void addOffsetToSp(u16);
+    template <bool, bool>     void pushPop(u16);
+    template <bool, u8>       void multipleLoadStore(u16);
+    template <u8>             void conditionalBranch(u16);
     void softwareInterruptThumb(u16);
     void unconditionalBranch(u16);
-    void longBranchLink(u16);
+    template <bool>           void longBranchLink(u16);
+    void undefinedThumb(u16);
+
+    // thumb handlers, indexed by bits 15-6 of an instruction
+    using ThumbHandler = void (Arm7::*)(u16);
+    static const std::array<ThumbHandler, 1024> thumb_lut;
 
     // software interrupts (swi)
     void swiSoftReset();
@@ -192,10 +225,63 @@ private:
     u32  read16(u32, bool sign = false);
     u32  read32(u32, bool ldr = false);
     u32  readUnused(u32);
+
+    // reads before alignment and sign extension, a single host load with fastmem
+    u32  load8(u32 address)  { return fastmem_enabled ? fastmem.read8(address)  : busRead8(address); }
+    u32  load16(u32 address) { return fastmem_enabled ? fastmem.read16(address) : busRead16(address); }
+    u32  load32(u32 address) { return fastmem_enabled ? fastmem.read32(address) : busRead32(address); }
+
+    // reads that don't go through fastmem, or fault out of it
+    u32  busRead8(u32);
+    u32  busRead16(u32);
+    u32  busRead32(u32);
+
+    Fastmem fastmem;
+    static u32  fastmemRead(void *, u32, int);
+    static void fastmemWrite(void *, u32, u32, int);
     void write8(u32, u8);
     void write16(u32, u16);
     void write32(u32, u32);
 
+    // cached interpreter
+    Block &compileBlock(u32, State);
+    int  execute(MicroOp const &, State);
+    bool interruptPending();
+
+    // the cpu can't run on, it is halted or a DMA is about to take the bus
+    bool halted() { return mem->halt_state != HaltState::RUNNING || mem->dma_starting; }
+
+    // set when the last branch taken closed an idle loop
+    bool idle_loop;
+    void checkIdleLoop(u32);
+    void skipIdleLoop(u64);
+
+    // jit
+    Jit jit;
+    u32 jit_generation;
+    u64 jit_start;    // scheduler clock when the block was entered
+    u64 jit_deadline; // end of the block's budget
+    static int jitStep(Arm7 *, MicroOp const *, int);
+    friend class Jit;
+
+    // banked registers
+    u32  getStatusRegister(u32);
+    void setStatusRegister(u32, u32);
+    void switchBank(Mode, Mode);
+
+    // flags of the last flag setting ALU op, only written to the cpsr once something reads them
+    struct LazyFlags
+    {
+        enum { NONE, LOGICAL, ADDITION, SUBTRACTION } op;
+        u8  carry; // carry out of a logical op
+        u32 op1;
+        u32 op2;
+        u32 result;
+    } lazy_flags;
+
+    void resolveFlags() { if (lazy_flags.op != LazyFlags::NONE) materializeFlags(); }
+    void materializeFlags();
+
     // misc
     void updateFlagsLogical(u32, u8);
     void updateFlagsAddition(u32, u32, u32);
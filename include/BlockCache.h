@@ -0,0 +1,99 @@
+/* discovery
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ *
+ * FILE: BlockCache.h
+ * DATE: October 16th, 2026
+ * DESCRIPTION: cache of pre-decoded blocks of guest code for the cached interpreter
+ */
+#pragma once
+
+#include <bitset>
+#include <unordered_map>
+#include <vector>
+
+#include "common.h"
+
+class Arm7;
+
+// a decoded instruction, replayed by Arm7::runBlock
+struct MicroOp
+{
+    union
+    {
+        void (Arm7::*arm)(u32);
+        void (Arm7::*thumb)(u16);
+    };
+
+    u32 opcode;
+    u32 address;
+};
+
+// straight-line run of guest code, ending at a branch or at the end of a page
+struct Block
+{
+    std::vector<MicroOp> ops;
+
+    // native code compiled by the jit, see Jit::Code
+    int (*code)(int) = nullptr;
+};
+
+class BlockCache
+{
+public:
+    BlockCache();
+
+    // incremented every time blocks are dropped, so a running block can notice it was freed
+    u32 generation;
+
+    Block *find(u32, State);
+    Block &insert(u32, State, Block &&);
+    void clear();
+
+    // drop blocks on the EWRAM / IWRAM page written to
+    void invalidate(u32 address)
+    {
+        int page = getPage(address);
+
+        if (page >= 0 && code_pages[page])
+            drop(page);
+    }
+
+    // drop blocks on every page of a range written to at once
+    void invalidate(u32 address, u32 length)
+    {
+        for (u32 page = address & ~(PAGE_SIZE - 1); page < address + length; page += PAGE_SIZE)
+            invalidate(page);
+    }
+
+    // blocks never cross a page, so each one only has to be tracked on a single page
+    static constexpr int PAGE_SHIFT = 8;
+    static constexpr u32 PAGE_SIZE  = 1 << PAGE_SHIFT;
+
+private:
+    // RAM is tracked in 256 byte pages, EWRAM pages first then IWRAM
+    static constexpr int EWRAM_PAGES = 0x40000 >> PAGE_SHIFT;
+    static constexpr int IWRAM_PAGES = 0x8000 >> PAGE_SHIFT;
+    static constexpr int NUM_PAGES = EWRAM_PAGES + IWRAM_PAGES;
+
+    std::unordered_map<u32, Block> blocks;
+
+    // keys of the blocks on each page, and whether a page holds any
+    std::vector<u32> page_blocks[NUM_PAGES];
+    std::bitset<NUM_PAGES> code_pages;
+
+    void drop(int);
+
+    static u32 key(u32 pc, State state) { return pc | (state == State::THUMB ? 1 : 0); }
+
+    // page index of an EWRAM / IWRAM address, -1 for other regions
+    static int getPage(u32 address)
+    {
+        switch (address >> 24)
+        {
+            case 0x2: return (address & 0x3FFFF) >> PAGE_SHIFT;
+            case 0x3: return EWRAM_PAGES + ((address & 0x7FFF) >> PAGE_SHIFT);
+            default:  return -1;
+        }
+    }
+};
@@ -0,0 +1,72 @@
+/* discovery
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ *
+ * FILE: Fastmem.h
+ * DATE: October 16th, 2026
+ * DESCRIPTION: guest address space mapped into host virtual memory
+ */
+#pragma once
+
+#include "common.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <csignal>
+#endif
+
+class Memory;
+
+// arena accessors, implemented in assembly so a fault can be traced back to them, see Fastmem.cpp
+extern "C"
+{
+    u32  fastmem_read8(u8 *, u64);
+    u32  fastmem_read16(u8 *, u64);
+    u32  fastmem_read32(u8 *, u64);
+    void fastmem_write16(u8 *, u64, u32);
+    void fastmem_write32(u8 *, u64, u32);
+}
+
+class Fastmem
+{
+public:
+    Fastmem();
+    ~Fastmem();
+
+    // needs memfd_create and a SIGSEGV handler that can patch x86-64 registers
+    #if defined(__x86_64__) && defined(__linux__)
+    static constexpr bool supported = true;
+    #else
+    static constexpr bool supported = false;
+    #endif
+
+    // accesses that fault, called with the context, address, size in bytes and value for writes
+    using ReadHandler  = u32  (*)(void *, u32, int);
+    using WriteHandler = void (*)(void *, u32, u32, int);
+
+    // move RAM and the loaded ROM into shared memory and map the arena, false if the host refused
+    bool init(Memory *, ReadHandler, WriteHandler, void *);
+
+    // a single host load or store, MMIO and everything else unmapped goes to the handlers
+    u32  read8(u32 address)               { return fastmem_read8(arena, address); }
+    u32  read16(u32 address)              { return fastmem_read16(arena, address); }
+    u32  read32(u32 address)              { return fastmem_read32(arena, address); }
+    void write16(u32 address, u16 value)  { fastmem_write16(arena, address, value); }
+    void write32(u32 address, u32 value)  { fastmem_write32(arena, address, value); }
+
+private:
+    // covers the whole 32 bit bus, so no address can land outside of it
+    static constexpr u64 ARENA_SIZE = 0x100000000;
+
+    u8 *arena;
+    int fd;
+
+    ReadHandler  read_handler;
+    WriteHandler write_handler;
+    void *ctx;
+
+    bool alias(u32, u32, u32, bool);
+
+    #if defined(__x86_64__) && defined(__linux__)
+    static void onFault(int, siginfo_t *, void *);
+    #endif
+};
@@ -26,6 +26,9 @@ constexpr u16 IRQ_DMA3    = 1 << 11;
 constexpr u16 IRQ_KEYPAD  = 1 << 12;
 constexpr u16 IRQ_GAMEPAK = 1 << 13;
 
+// interrupts that can end STOP mode
+constexpr u16 IRQ_STOP_WAKE = IRQ_COM | IRQ_KEYPAD | IRQ_GAMEPAK;
+
 class IRQ
 {
 public:
@@ -0,0 +1,88 @@
+/* discovery
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ *
+ * FILE: IdleLoop.h
+ * DATE: October 16th, 2026
+ * DESCRIPTION: detection of busy-wait loops that only poll memory for an interrupt
+ */
+#pragma once
+
+#include <array>
+#include <unordered_map>
+
+#include "common.h"
+
+class Memory;
+
+// override values, anything else is the address of a branch that closes an idle loop
+constexpr u32 IDLE_LOOP_AUTO = 0xFFFFFFFF; // find idle loops automatically
+constexpr u32 IDLE_LOOP_NONE = 0xFFFFFFFE; // never skip idle loops
+
+class IdleLoopDetector
+{
+public:
+    IdleLoopDetector();
+
+    // per-game override, see IDLE_LOOP_AUTO and IDLE_LOOP_NONE
+    void setOverride(u32);
+
+    // true if the backward branch at branch to target closes a loop that can't make progress on its own
+    // the loop's loads are checked against the registers they are addressed from
+    bool isIdle(Memory *, u32, u32, State, u32 const *);
+
+    // longest loop body considered, in instructions
+    static constexpr int MAX_LOOP_LEN = 8;
+
+private:
+    u32 override_address;
+
+    // a load from r[base] + r[index] + offset, either register is -1 when unused
+    // registers the loop sets to a constant are folded into the offset, the others are never written by the loop
+    struct Load
+    {
+        int base;
+        int index;
+        u32 offset;
+        int size;
+    };
+
+    // result of analyzing a loop, keyed by branch address
+    // idle loops in RAM keep their code so they can be checked against what is there now
+    struct Loop
+    {
+        u32 target;
+        bool idle;
+        std::array<u32, MAX_LOOP_LEN> code;
+
+        int num_loads;
+        std::array<Load, MAX_LOOP_LEN> loads;
+    };
+
+    std::unordered_map<u32, Loop> loops;
+
+    Loop analyze(Memory *, u32, u32, State);
+    bool unchanged(Memory *, Loop const &, u32, State);
+
+    // registers read and written by a single instruction, bits 16 - 19 stand for the cpsr flags
+    struct Access
+    {
+        u32 reads;
+        u32 writes;
+
+        // a load's address and size, as in Load
+        bool load;
+        Load from;
+
+        // an immediate moved into a register, -1 for none
+        int constant_reg;
+        u32 constant;
+    };
+
+    static bool pollable(u32, int);
+
+    static bool accessArm(u32, Access &);
+    static bool accessThumb(u16, Access &);
+
+    static u32 key(u32 branch, State state) { return branch | (state == State::THUMB ? 1 : 0); }
+};
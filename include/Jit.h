@@ -0,0 +1,91 @@
+/* discovery
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ *
+ * FILE: Jit.h
+ * DATE: October 16th, 2026
+ * DESCRIPTION: x86-64 recompiler for blocks of guest code
+ */
+#pragma once
+
+#include <utility>
+#include <vector>
+
+#include "common.h"
+
+class Arm7;
+struct Block;
+struct MicroOp;
+
+class Jit
+{
+public:
+    Jit();
+    ~Jit();
+
+    // native code is only emitted on x86-64 System V hosts
+    #if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+    static constexpr bool supported = true;
+    #else
+    static constexpr bool supported = false;
+    #endif
+
+    // compiled block, called with the cycle budget and returning the cycles elapsed
+    using Code = int (*)(int);
+
+    // translate a decoded block, nullptr if the code buffer is full or unavailable
+    Code compile(Arm7 &, Block const &, State);
+
+    // throw away all compiled code, every Code handed out becomes invalid
+    void reset();
+
+    // true once another block might not fit in the code buffer
+    bool full() const { return buffer && ptr + MAX_BLOCK_SIZE > buffer + capacity; }
+
+private:
+    static constexpr size_t BUFFER_SIZE = 8 * 1024 * 1024;
+
+    // upper bound on the code emitted for a block of 128 thumb instructions
+    static constexpr size_t MAX_BLOCK_SIZE = 64 * 1024;
+
+    // data processing instruction with register / immediate operands that is emitted inline
+    struct AluOp
+    {
+        enum Op { AND, EOR, SUB, RSB, ADD, ORR, MOV, BIC, MVN } op;
+        enum Flags { NONE, LOGICAL, ADDITION, SUBTRACTION } flags;
+
+        int Rd; // -1 if the result is only used for flags
+        int Rn;
+        int Rm; // -1 if the second operand is the immediate
+        u32 immediate;
+        int carry; // C flag after a logical op, -1 if unchanged
+        u8  i;     // internal cycles on top of 1S
+    };
+
+    static bool decodeArm(u32, AluOp &);
+    static bool decodeThumb(u16, AluOp &);
+
+    u8 *buffer;
+    u8 *ptr;
+    size_t capacity;
+
+    // rel32 fields of jumps to the exit stubs, patched once the block is emitted
+    // leaving after an inline instruction also has to record it in the pipeline
+    std::vector<std::pair<u8 *, MicroOp const *>> exits;
+    std::vector<u8 *> call_exits;
+    std::vector<u8 *> step_exits;
+
+    void emitAlu(Arm7 &, MicroOp const &, AluOp const &, State);
+    void emitCall(MicroOp const &);
+    void emitCycles(Arm7 &, u32, State, u8);
+
+    // x86-64 encoding
+    void emit8(u8 byte) { *ptr++ = byte; }
+    void emit32(u32);
+    void emit64(u64);
+    void load(int, int);
+    void store(int, int);
+    u8  *jump();
+    u8  *jump(u8);
+    void patch(u8 *, u8 *);
+};
@@ -90,6 +90,10 @@ struct LcdStat
         u32 dx;
         u32 dy;
 
+        // internal reference point of BG2 / BG3, 20.8 fixed point
+        // loaded from dx, dy when they are written and at each vblank, then moved by pb, pd every scanline
+        s32 ref_x, ref_y;
+
         int width, height; // dimensions of map in pixels
         int voff,  hoff;   // vertical, horizontal offsets
     } bgcnt[4]; // backgrounds 0-3
@@ -161,6 +165,8 @@ struct LcdStat
             bgcnt[i].enabled = 0;
             bgcnt[i].dx      = 0;
             bgcnt[i].dy      = 0;
+            bgcnt[i].ref_x   = 0;
+            bgcnt[i].ref_y   = 0;
             bgcnt[i].width   = 0;
             bgcnt[i].height  = 0;
             bgcnt[i].voff    = 0;
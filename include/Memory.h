@@ -20,6 +20,25 @@
 #include "log.h"
 #include "Backup.h"
 
+class BlockCache;
+
+// cpu power state, set by writes to HALTCNT
+enum class HaltState
+{
+    RUNNING,
+    HALT, // cpu paused until an enabled interrupt is requested
+    STOP, // cpu and video paused until a keypad, gamepak or serial interrupt is requested
+};
+
+// when a DMA channel starts, the value of its start timing bits
+enum class DmaTiming
+{
+    IMMEDIATE,
+    VBLANK,
+    HBLANK,
+    SPECIAL, // sound FIFO for DMA 1 and 2, video capture for DMA 3
+};
+
 // start and end addresses of internal memory regions
 constexpr u32 MEM_BIOS_END          = 0x3FFF;
 constexpr u32 MEM_EWRAM_START       = 0x2000000;
@@ -46,25 +65,53 @@ constexpr u32 MEM_IO_REG_SIZE      = 0x400;
 constexpr u32 MEM_PALETTE_RAM_SIZE = 0x400;
 constexpr u32 MEM_VRAM_SIZE        = 0x18000;
 constexpr u32 MEM_OAM_SIZE         = 0x400;
-constexpr u32 MEM_SIZE             = 0x8000000;
+constexpr u32 MEM_ROM_MAX_SIZE     = 0x2000000;
+
+// VRAM writes are tracked in 32 byte units, the size of a 4bpp tile
+constexpr u32 VRAM_TILE_SIZE       = 32;
+constexpr int VRAM_NUM_TILES       = MEM_VRAM_SIZE / VRAM_TILE_SIZE;
 
 class Memory
 {
     public:
-        Memory(LcdStat *, Timer *, Gamepad *);
+        Memory(LcdStat *, Timer *, Gamepad *, Scheduler *);
         ~Memory();
 
-        u8 memory[MEM_SIZE];
+        // internal memory regions, without their mirrors
+        // the large ones are page aligned so fastmem can swap them for shared memory
+        alignas(64)   u8 bios[MEM_BIOS_SIZE];
+        alignas(4096) u8 ewram[MEM_EWRAM_SIZE];
+        alignas(4096) u8 iwram[MEM_IWRAM_SIZE];
+        alignas(64)   u8 io[MEM_IO_REG_SIZE];
+        alignas(64)   u8 palram[MEM_PALETTE_RAM_SIZE];
+        alignas(4096) u8 vram[MEM_VRAM_SIZE];
+        alignas(64)   u8 oam[MEM_OAM_SIZE];
 
         LcdStat *stat;
         Timer *timer;
         Gamepad *gamepad;
+        Scheduler *scheduler;
+
+        // cached interpreter blocks, dropped when the RAM they came from is written
+        BlockCache *block_cache;
+
+        // one bit per VRAM tile written since the PPU's tile cache last looked, see TileCache
+        u64 vram_dirty[VRAM_NUM_TILES / 64];
+
+        // drop whatever was cached from plain memory that was just written, code and VRAM tiles
+        void invalidate(u32);
+        void invalidate(u32, u32);
 
         // cart buffers & sizes
-        u8  cart_rom[0x2000000];
+        // the rom buffer is a read only mapping of the file, rounded up to a whole page
+        u8 *cart_rom;
         u8 *cart_ram;
         size_t rom_size;
+        size_t rom_capacity;
         size_t ram_size;
+
+        // 4 character code identifying the game, from the cart header
+        std::string gameCode() { return rom_size >= 0xB0 ? std::string((char *) &cart_rom[0xAC], 4) : ""; }
         
         struct DMA
         {
@@ -81,10 +128,19 @@ class Memory
             u32 dest_address;
         } dma[4];
 
-        u8 n_cycles;
-        u8 s_cycles;
+        // channels whose start event is pending, the cpu stops so they can take the bus
+        u8 dma_starting;
 
-        u8 haltcnt;
+        // cycles the cpu was stalled by DMA, for the frame loop to charge
+        int dma_cycles;
+
+        // cycles taken by one access to each region, [address >> 24][32 bit][sequential]
+        // includes the access itself, rebuilt whenever WAITCNT is written
+        u8 access_cycles[16][2][2];
+
+        u8 accessCycles(u32 address, bool word, bool sequential) { return access_cycles[address >> 24 & 0xF][word][sequential]; }
+
+        HaltState halt_state;
 
         enum class Region
         {
@@ -105,6 +161,7 @@ class Memory
         bool loadBios(std::string const &);
 
         // read / write from memory
+        // RAM and ROM go straight through the page tables, see Memory.inl
         u32  read32(u32);
         u16  read16(u32);
         u8   read8(u32);
@@ -112,6 +169,14 @@ class Memory
         void write16(u32, u16);
         void write32(u32, u32);
 
+        // the bus is split into 16 KB pages, each mapped to a host pointer or null if it needs the slow path
+        static constexpr int PAGE_SHIFT = 14;
+        static constexpr u32 PAGE_MASK  = (1 << PAGE_SHIFT) - 1;
+        static constexpr int NUM_PAGES  = 0x10000000 >> PAGE_SHIFT;
+
+        u8 *readPage(u32 address)  { return address < 0x10000000 ? read_table[address >> PAGE_SHIFT]  : nullptr; }
+        u8 *writePage(u32 address) { return address < 0x10000000 ? write_table[address >> PAGE_SHIFT] : nullptr; }
+
         // unprotected read/write from memory
         // dangerous, but fast
         u32  read32Unsafe(u32);
@@ -124,15 +189,92 @@ class Memory
         // DMA transfer routine
         void _dma(int);
 
+        // start the enabled channels waiting on a timing, out of the ones given
+        void triggerDma(DmaTiming, u8 channels = 0xF);
+
         static Region getMemoryRegion(u32);
 
     private:
-        void dma0();
-        void dma1();
-        void dma2();
-        void dma3();
+        u8 *read_table[NUM_PAGES];
+        u8 *write_table[NUM_PAGES];
+
+        void mapPages();
+
+        // byte backing an address in any mirror, null for open bus and anything without storage
+        u8 *backing(u32);
+
+        // offset into vram of an address in any of its mirrors
+        // 0x6018000 - 0x601FFFF mirrors 0x6010000 - 0x6017FFF
+        static u32 vramOffset(u32 address)
+        {
+            u32 offset = address & 0x1FFFF;
+            return offset >= MEM_VRAM_SIZE ? offset - 0x8000 : offset;
+        }
+
+        // io register at an address, for the handlers that combine bytes already written
+        u8 &ioReg(u32 address) { return io[address & (MEM_IO_REG_SIZE - 1)]; }
+
+        // io registers with side effects, see mapIo
+        // a read handler returns the whole register, a write handler gets a mask of the bytes written
+        struct IoRegister
+        {
+            u32 address;
+            int size;
+            u32  (*read)(Memory *, u32);
+            void (*write)(Memory *, u32, u32);
+        };
+
+        // register covering each byte of the io region, null for plain storage
+        IoRegister const *io_table[MEM_IO_REG_SIZE];
+
+        void mapIo();
+        void updateWaitstates();
+        u32  readIo(u32, int);
+        void writeIo(u32, u32, int);
+
+        // MMIO, backup, open bus and anything else that isn't plain memory
+        u8   read8Slow(u32);
+        void write8Slow(u32, u8);
+
+        // palette RAM and OAM in one access, everything else and misaligned addresses byte by byte
+        u16  read16Slow(u32);
+        u32  read32Slow(u32);
+        void write16Slow(u32, u16);
+        void write32Slow(u32, u32);
+
+        u8 *dmaPointer(u32, bool, u32 &);
+        u32 dmaBulk(u32, u32, u32, bool, u32);
+
+        // enabled channels waiting on each timing, as bitmasks
+        u8 dma_armed[4];
+
+        void armDma(int);
+        void scheduleDma(int);
+        void startDma(int);
+
+        template <int n>
+        static void onDmaStart(void *mem) { static_cast<Memory *>(mem)->startDma(n); }
+
+        // scheduler event and start handler of each channel
+        static constexpr EventType dma_event[4] =
+        {
+            EventType::DMA0_START,
+            EventType::DMA1_START,
+            EventType::DMA2_START,
+            EventType::DMA3_START,
+        };
+
+        static constexpr Scheduler::Handler dma_handler[4] =
+        {
+            &Memory::onDmaStart<0>,
+            &Memory::onDmaStart<1>,
+            &Memory::onDmaStart<2>,
+            &Memory::onDmaStart<3>,
+        };
 
         void writeFlash(u32, u8);
 
         Backup *backup;
-};
\ No newline at end of file
+};
+
+#include "Memory.inl"
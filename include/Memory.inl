@@ -0,0 +1,99 @@
+// memory inline methods
+#include <cstring>
+
+#include "BlockCache.h"
+
+// RAM and ROM are read and written with single host loads and stores, the GBA is little endian too
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "Memory needs a little endian host");
+
+inline u8 Memory::read8(u32 address)
+{
+    if (u8 *page = readPage(address))
+        return page[address & PAGE_MASK];
+
+    return read8Slow(address);
+}
+
+inline u16 Memory::read16(u32 address)
+{
+    u8 *page = readPage(address);
+
+    if (page && (address & 1) == 0)
+    {
+        u16 value;
+        memcpy(&value, page + (address & PAGE_MASK), sizeof(value));
+        return value;
+    }
+
+    return read16Slow(address);
+}
+
+inline u32 Memory::read32(u32 address)
+{
+    u8 *page = readPage(address);
+
+    if (page && (address & 3) == 0)
+    {
+        u32 value;
+        memcpy(&value, page + (address & PAGE_MASK), sizeof(value));
+        return value;
+    }
+
+    return read32Slow(address);
+}
+
+// writes to RAM may land on cached code or VRAM tiles
+inline void Memory::invalidate(u32 address)
+{
+    if (block_cache)
+        block_cache->invalidate(address);
+
+    if ((address >> 24) == 0x6)
+    {
+        u32 tile = vramOffset(address) / VRAM_TILE_SIZE;
+        vram_dirty[tile / 64] |= 1ull << (tile % 64);
+    }
+}
+
+inline void Memory::write8(u32 address, u8 value)
+{
+    if (u8 *page = writePage(address))
+    {
+        page[address & PAGE_MASK] = value;
+
+        invalidate(address);
+        return;
+    }
+
+    write8Slow(address, value);
+}
+
+inline void Memory::write16(u32 address, u16 value)
+{
+    u8 *page = writePage(address);
+
+    if (page && (address & 1) == 0)
+    {
+        memcpy(page + (address & PAGE_MASK), &value, sizeof(value));
+
+        invalidate(address);
+        return;
+    }
+
+    write16Slow(address, value);
+}
+
+inline void Memory::write32(u32 address, u32 value)
+{
+    u8 *page = writePage(address);
+
+    if (page && (address & 3) == 0)
+    {
+        memcpy(page + (address & PAGE_MASK), &value, sizeof(value));
+
+        invalidate(address);
+        return;
+    }
+
+    write32Slow(address, value);
+}
@@ -17,6 +17,7 @@
 
 #include "Memory.h"
 #include "Scheduler.h"
+#include "TileCache.h"
 #include "common.h"
 #include "mmio.h"
 
@@ -34,11 +35,16 @@ constexpr int SCREENBLOCK_LEN     = 0x800;
 constexpr int PALBANK_LEN         = 32; // length of each of palette RAM's 16 banks in 4bpp mode (s-tiles)
 
 constexpr int NUM_OBJS            = 128; // number of sprites that can be rendered
+
+constexpr int OBJ_CYCLES             = 1210; // cycles per scanline for drawing objs
+constexpr int OBJ_CYCLES_HBLANK_FREE = 954;  // same, with OAM accessible during hblank
 constexpr int NUM_BG              = 4;
 
 constexpr u32 LOWER_SPRITE_BLOCK  = 0x6010000;
 constexpr u32 HIGHER_SPRITE_BLOCK = 0x6014000;
 
+constexpr u16 TRANSPARENT         = 0x8000; // transparent pixel color
+
 constexpr u32 BG_PALETTE          = 0x5000000;
 constexpr u32 SPRITE_PALETTE      = 0x5000200;
 
@@ -54,32 +60,46 @@ public:
 
     u32 screen_buffer[SCREEN_HEIGHT][SCREEN_WIDTH];
 
-    u32 cycles;
     u8 scanline;
 
     void reset();
-    void tick();
 
 private:
+    // scheduler events, each one schedules the next
+    void hdrawEnd();
+    void hblankEnd();
+    void vblankStart();
+    void vcountMatch();
+
+    static void onHdrawEnd(void *ppu)  { static_cast<PPU *>(ppu)->hdrawEnd(); }
+    static void onHblankEnd(void *ppu) { static_cast<PPU *>(ppu)->hblankEnd(); }
+
+    // timestamp of the next hdraw / hblank end
+    u64 next_event;
+
     // internal buffers linked from memory
     u8 *palram;
     u8 *vram;
     u8 *oam;
 
+    // tiles decoded to palette indices, BG and object pixels are read from here instead of vram
+    TileCache tile_cache;
+
     u8 frame; // counts 0 - 60
     u8 fps;
     clock_t old_time;
 
     u32 scanline_buffer[SCREEN_WIDTH];
 
-    struct ObjPixel
-    {
-        u16 color;
-        int priority;        
-    } obj_scanline_buffer[SCREEN_WIDTH];
+    // objs drawn on the current scanline, kept as separate arrays so they can be composited a vector at a time
+    std::array<u16, SCREEN_WIDTH> obj_color;
+    std::array<u16, SCREEN_WIDTH> obj_priority;
 
     int objwin_scanline_buffer[SCREEN_WIDTH];
 
+    // layers visible through the windows at each pixel, bits 0 - 3 for the bgs and bit 4 for objs
+    u8 layer_mask[SCREEN_WIDTH];
+
     std::array<u16, SCREEN_WIDTH> bg_buffer[NUM_BG];
     std::vector<int> bg_list; // list of currently enabled bgs
 
@@ -115,14 +135,23 @@ private:
         int  width,  height;
         int hwidth, hheight;
 
-        // affine matrix params
-        float pa;
-        float pb;
-        float pc;
-        float pd;
+        // affine matrix params, 8.8 fixed point
+        s16 pa;
+        s16 pb;
+        s16 pc;
+        s16 pd;
 
     } objs[NUM_OBJS]; // can support 128 objects
 
+    // indices of the objs on each scanline, in OAM order, rebuilt along with objs
+    struct ObjBin
+    {
+        int count;
+        u8 index[NUM_OBJS];
+    } obj_bins[SCREEN_HEIGHT];
+
+    bool bins_hblank_free; // DISPCNT bit 5 when the bins were built, it sets the cycle budget
+
     // video mode renders
     void render();
     void renderScanline();
@@ -131,13 +160,23 @@ private:
     void renderScanlineBitmap(int);
     void renderScanlineObj();
 
+    // combine the bgs in bg_list, objs and the backdrop into the final colors of a scanline, see composite.cpp
+    // the widest version the host supports is picked once
+    void buildLayerMask();
+    void (PPU::*composite)(u16 *, u16);
+    void compositeScalar(u16 *, u16);
+
+    #if defined(__x86_64__)
+    void compositeSSE41(u16 *, u16);
+    void compositeAVX2(u16 *, u16);
+    #endif
+
     // misc
     inline u16 getObjPixel4BPP(u32, int, int, int);
     inline u16 getObjPixel8BPP(u32, int, int);
-    inline u16 getBGPixel4BPP(u32, int, int, int);
-    inline u16 getBGPixel8BPP(u32, int, int);
+    inline u16 getBGPixel8BPP(u32, int, int, bool);
     void updateAttr();
-    inline bool isInWindow(int, int, int);
+    void binObjs();
 
     u32 color_lut[0x8000];
     inline u32 u16ToU32Color(u16);
@@ -1,27 +1,69 @@
 #pragma once
 
 #include "common.h"
-#include <functional>
-#include <list>
+#include <array>
+
+// every kind of event the scheduler can hold, at most one of each is pending at a time
+enum class EventType
+{
+    HDRAW_END,
+    HBLANK_END,
+    TIMER0_OVERFLOW,
+    TIMER1_OVERFLOW,
+    TIMER2_OVERFLOW,
+    TIMER3_OVERFLOW,
+    DMA0_START,
+    DMA1_START,
+    DMA2_START,
+    DMA3_START,
+    NUM_EVENTS
+};
+
+constexpr int NUM_EVENTS = static_cast<int>(EventType::NUM_EVENTS);
 
 class Scheduler
 {
 public:
-    Scheduler() { cycles = 0; }
+    Scheduler();
+
+    // event callback, receives the context pointer it was scheduled with
+    using Handler = void (*)(void *);
 
     u64 cycles;
-    void add(int, std::function<void(void)>, int id = -1);
+
+    // (re)schedules an event, replacing it if it is already pending
+    void add(int, EventType, Handler, void *);
+    void addAt(u64, EventType, Handler, void *);
     void advance(int);
-    void remove(int);
+    void remove(EventType);
+
+    bool isPending(EventType type) { return pos[static_cast<int>(type)] != -1; }
+
+    // the clock has passed the next event, advance(0) fires it
+    bool due() { return size > 0 && events[heap[0]].timestamp < cycles; }
+
+    // cycles that must pass before the next event fires
+    int cyclesUntilNextEvent();
 
 private:
     struct Event
     {
         u64 timestamp;
-        std::function<void(void)> handler;
-        int id;
+        u64 order; // breaks ties so events at the same timestamp fire in the order they were added
+        Handler handler;
+        void *ctx;
     };
 
-    // TODO: use a more efficient DS than a list
-    std::list<Event> events;
-};
\ No newline at end of file
+    // one slot per event type, the heap holds indices into it
+    std::array<Event, NUM_EVENTS> events;
+    std::array<int, NUM_EVENTS> heap;
+    std::array<int, NUM_EVENTS> pos; // index of each type in the heap, -1 if not pending
+    int size;
+    u64 next_order;
+
+    bool before(int, int);
+    void swap(int, int);
+    void siftUp(int);
+    void siftDown(int);
+    void erase(int);
+};
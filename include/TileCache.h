@@ -0,0 +1,72 @@
+/* discovery
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ *
+ * FILE: TileCache.h
+ * DATE: October 16th, 2026
+ * DESCRIPTION: cache of VRAM tiles decoded to one palette index per pixel
+ */
+#pragma once
+
+#include <bitset>
+
+#include "Memory.h"
+#include "common.h"
+
+// 8x8 tiles of VRAM expanded to a byte per pixel, 8 rows of 8 palette indices, index 0 is transparent
+// each tile is decoded the first time it is drawn and again after Memory marks its VRAM dirty
+class TileCache
+{
+public:
+    TileCache(Memory *);
+
+    // drop the tiles written since the last call, once per scanline before anything is drawn
+    void sync();
+
+    // decoded tile at a VRAM offset, as 4bpp or 8bpp, mirrored horizontally if flipped
+    // tiles past the end of VRAM are transparent
+    u8 const *tile4(u32, bool);
+    u8 const *tile8(u32, bool);
+
+private:
+    Memory *mem;
+
+    // [tile][hflip][y * 8 + x]
+    // an 8bpp tile takes two 32 byte units, it is cached under the first of them
+    u8 decoded4[VRAM_NUM_TILES][2][64];
+    u8 decoded8[VRAM_NUM_TILES][2][64];
+
+    std::bitset<VRAM_NUM_TILES> valid4;
+    std::bitset<VRAM_NUM_TILES> valid8;
+
+    void decode4(u32);
+    void decode8(u32);
+};
+
+inline u8 const *TileCache::tile4(u32 offset, bool hflip)
+{
+    static constexpr u8 blank[64] = {};
+
+    u32 tile = offset / VRAM_TILE_SIZE;
+    if (tile >= VRAM_NUM_TILES)
+        return blank;
+
+    if (!valid4[tile])
+        decode4(tile);
+
+    return decoded4[tile][hflip];
+}
+
+inline u8 const *TileCache::tile8(u32 offset, bool hflip)
+{
+    static constexpr u8 blank[64] = {};
+
+    u32 tile = offset / VRAM_TILE_SIZE;
+    if (tile >= VRAM_NUM_TILES)
+        return blank;
+
+    if (!valid8[tile])
+        decode8(tile);
+
+    return decoded8[tile][hflip];
+}
@@ -11,7 +11,6 @@
 
 #include "common.h"
 #include "Scheduler.h"
-#include <functional>
 
 class Timer
 {
@@ -46,8 +45,6 @@ private:
         u16 data;
         int prescalar;
         u64 cycle_started;
-
-        std::function<void(void)> onOverflow;
     } channel[4];
 
     Scheduler *scheduler;
@@ -55,4 +52,24 @@ private:
     void cascade(int);
     void tick(int);
     void overflow(int);
-};
\ No newline at end of file
+
+    template <int ch>
+    static void onOverflow(void *timer) { static_cast<Timer *>(timer)->overflow(ch); }
+
+    // scheduler event and overflow handler of each channel
+    static constexpr EventType overflow_event[4] =
+    {
+        EventType::TIMER0_OVERFLOW,
+        EventType::TIMER1_OVERFLOW,
+        EventType::TIMER2_OVERFLOW,
+        EventType::TIMER3_OVERFLOW,
+    };
+
+    static constexpr Scheduler::Handler overflow_handler[4] =
+    {
+        &Timer::onOverflow<0>,
+        &Timer::onOverflow<1>,
+        &Timer::onOverflow<2>,
+        &Timer::onOverflow<3>,
+    };
+};
@@ -11,6 +11,9 @@
 
 #include <SDL2/SDL.h>
 #include <string>
+#include <map>
+
+#include "common.h"
 
 struct Keymap 
 {
@@ -33,6 +36,13 @@ namespace config
     extern std::string bios_name;
     extern bool show_help;
     extern bool debug; 
+    extern bool cached_interpreter;
+    extern bool jit;
+    extern bool fastmem;
+    extern bool idle_loop_skip;
+
+    // per-game idle loop overrides, keyed by game code
+    extern std::map<std::string, u32> idle_loops;
     
     // handle config file
     extern std::string config_file;
@@ -17,10 +17,11 @@ using std::string;
 namespace util
 {
     // determine which type of operation the instruction is
-    ArmInstruction getInstructionFormat(u32);
+    // constexpr so Arm7 can build its handler tables at compile time
+    constexpr ArmInstruction getInstructionFormat(u32);
 
     // determine which type of thumb operation an instruction is
-    ThumbInstruction getInstructionFormat(u16);
+    constexpr ThumbInstruction getInstructionFormat(u16);
 
     // test if path exists
     bool pathExists(std::string const &);
@@ -21,15 +21,17 @@ extern IRQ *irq;
 
 int PRINT = 0;
 
-Arm7::Arm7(Memory *mem) : mem(mem)
+Arm7::Arm7(Memory *mem, Scheduler *scheduler) : mem(mem), scheduler(scheduler)
 {
-    registers = {0};               // zero out registers
-    registers.r15 = 0x8000000;     // starting address of gamepak flash rom
+    registers = {};               // zero out registers
+    registers.r[15] = 0x8000000;   // starting address of gamepak flash rom
 
-    registers.r13     = 0x3007F00; // starting address of user stack
+    registers.r[13]   = 0x3007F00; // starting address of user stack
     registers.r13_svc = 0x3007FE0; // starting address of swi stack
     registers.r13_irq = 0x3007FA0; // starting address of interrupt stack
 
+    // start out with the user bank in the register file, so setMode can swap in the svc one
+    registers.cpsr.mode = 0b10000;
     setMode(Mode::SVC);
     setState(State::ARM);
 
@@ -38,14 +40,21 @@ Arm7::Arm7(Memory *mem) : mem(mem)
     registers.cpsr.i = 1;
 
     pipeline_full = false;
+    jit_enabled = false;
+    fastmem_enabled = false;
+    lazy_flags.op = LazyFlags::NONE;
     cycles = 0;
     in_interrupt  = false;
+    idle_loop     = false;
 
     last_read_bios = bios_read_state[0];
+
+    // let memory drop cached blocks when RAM holding code is written
+    mem->block_cache = &block_cache;
     
     // different initialization for the testing environment
     #ifdef TEST
-    registers.r15 = 0;
+    registers.r[15] = 0;
     set_state(USR);
     mem = new Memory();
     #endif
@@ -70,6 +79,8 @@ Mode Arm7::getMode()
 
 void Arm7::setMode(Mode mode)
 {
+    Mode old_mode = getMode();
+
     switch (mode)
     {
         case Mode::USR: registers.cpsr.mode = 0b10000; break;
@@ -82,10 +93,14 @@ void Arm7::setMode(Mode mode)
         default:
             assert(!"Error: unrecognized mode in Arm7::setMode");
     }
+
+    switchBank(old_mode, mode);
 }
 
 u8 Arm7::getConditionCodeFlag(ConditionFlag flag)
 {
+    resolveFlags();
+
     switch (flag)
     {
         case ConditionFlag::N: return registers.cpsr.n; 
@@ -107,6 +122,8 @@ void Arm7::setConditionCodeFlag(ConditionFlag flag, u8 bit)
         return;
     }
 
+    resolveFlags();
+
     switch (flag)
     {
         case ConditionFlag::N: registers.cpsr.n = bit; break;
@@ -152,14 +169,14 @@ void Arm7::fetch()
         switch (getState())
         {
             case State::ARM:
-                pipeline[0] = { read32(registers.r15), registers.r15 }; registers.r15 += 4;
-                pipeline[1] = { read32(registers.r15), registers.r15 }; registers.r15 += 4;
-                pipeline[2] = { read32(registers.r15), registers.r15 };
+                pipeline[0] = { read32(registers.r[15]), registers.r[15] }; registers.r[15] += 4;
+                pipeline[1] = { read32(registers.r[15]), registers.r[15] }; registers.r[15] += 4;
+                pipeline[2] = { read32(registers.r[15]), registers.r[15] };
                 break;
             case State::THUMB:
-                pipeline[0] = { read16(registers.r15), registers.r15 }; registers.r15 += 2;
-                pipeline[1] = { read16(registers.r15), registers.r15 }; registers.r15 += 2;
-                pipeline[2] = { read16(registers.r15), registers.r15 };
+                pipeline[0] = { read16(registers.r[15]), registers.r[15] }; registers.r[15] += 2;
+                pipeline[1] = { read16(registers.r[15]), registers.r[15] }; registers.r[15] += 2;
+                pipeline[2] = { read16(registers.r[15]), registers.r[15] };
                 break;
         }
 
@@ -170,10 +187,10 @@ void Arm7::fetch()
     switch (getState())
     {
         case State::ARM:
-            pipeline[2] = { read32(registers.r15), registers.r15 };
+            pipeline[2] = { read32(registers.r[15]), registers.r[15] };
             break;
         case State::THUMB:
-            pipeline[2] = { read16(registers.r15), registers.r15 };
+            pipeline[2] = { read16(registers.r[15]), registers.r[15] };
             break;
     }
 }
@@ -190,7 +207,7 @@ int Arm7::execute(u32 instruction)
         exit(5);
     }
 
-    // std::cout << std::hex << registers.r15 << "\n";
+    // std::cout << std::hex << registers.r[15] << "\n";
     
     switch (getState())
     {
@@ -202,52 +219,13 @@ int Arm7::execute(u32 instruction)
                 return cycles;
             }
             
-            switch(util::getInstructionFormat(instruction))
-            {
-                case ArmInstruction::BEX:  branchExchange(instruction);       break;
-                case ArmInstruction::B:    branchLink(instruction);           break;
-                case ArmInstruction::DP:   dataProcessing(instruction);       break;
-                case ArmInstruction::MUL:  multiply(instruction);             break;
-                case ArmInstruction::MULL: multiplyLong(instruction);         break;
-                case ArmInstruction::PSR:  psrTransfer(instruction);          break;
-                case ArmInstruction::SDT:  singleDataTransfer(instruction);   break;
-                case ArmInstruction::HDT:  halfwordDataTransfer(instruction); break;
-                case ArmInstruction::BDT:  blockDataTransfer(instruction);    break;
-                case ArmInstruction::SWP:  singleDataSwap(instruction);       break;
-                case ArmInstruction::INT:  softwareInterruptArm(instruction); break;
-                default:
-                    log(LogLevel::Error, "Cannot execute instruction {:x}, pc {:x}\n", (int) instruction, (int) registers.r15);
-                    registers.r15 &= ~0x3;
-            }
+            // bits 27-20 and 7-4 select the handler
+            (this->*arm_lut[(instruction >> 16 & 0xFF0) | (instruction >> 4 & 0xF)])(instruction);
             break;
 
         case State::THUMB:
-            u16 instr = static_cast<u16>(instruction);
-            switch(util::getInstructionFormat(instr))
-            {
-                case ThumbInstruction::MSR:    moveShiftedRegister(instr);     break;
-                case ThumbInstruction::ADDSUB: addSubtract(instr);             break;
-                case ThumbInstruction::IMM:    moveImmediate(instr);           break;
-                case ThumbInstruction::ALU:    aluThumb(instr);                break;
-                case ThumbInstruction::HI:     hiRegisterOps(instr);           break;
-                case ThumbInstruction::PC:     pcRelLoad(instr);               break;
-                case ThumbInstruction::MOV:    loadStoreRegOffset(instr);      break;
-                case ThumbInstruction::MOVS:   loadStoreSignedHalfword(instr); break;
-                case ThumbInstruction::MOVI:   loadStoreImmediate(instr);      break;
-                case ThumbInstruction::MOVH:   loadStoreHalfword(instr);       break;
-                case ThumbInstruction::SP:     spRelLoadStore(instr);          break;
-                case ThumbInstruction::LDA:    loadAddress(instr);             break;
-                case ThumbInstruction::ADDSP:  addOffsetToSp(instr);           break;
-                case ThumbInstruction::POP:    pushPop(instr);                 break;
-                case ThumbInstruction::MOVM:   multipleLoadStore(instr);       break;
-                case ThumbInstruction::B:      conditionalBranch(instr);       break;
-                case ThumbInstruction::SWI:    softwareInterruptThumb(instr);  break;
-                case ThumbInstruction::BAL:    unconditionalBranch(instr);     break;
-                case ThumbInstruction::BL:     longBranchLink(instr);          break;
-                default:
-                    std::cerr << "Cannot execute thumb instruction: " << (u16) instruction << " " << std::hex << registers.r15 << "\n";
-                    registers.r15 &= ~0x1;
-            }
+            // bits 15-6 select the handler
+            (this->*thumb_lut[instruction >> 6 & 0x3FF])(static_cast<u16>(instruction));
             break;
     }
 
@@ -261,76 +239,282 @@ int Arm7::execute(u32 instruction)
     return cycles;
 }
 
-u32 Arm7::getRegister(u32 reg)
+/*
+ * Execute instructions back to back until the scheduler reaches deadline, an event is due,
+ * an interrupt becomes pending or the interrupt handler returns to the BIOS.
+ * The scheduler clock moves with every instruction so timers read the current time,
+ * but no events are fired, the caller has to do that with advance(0).
+ * Returns the cycles elapsed.
+ */
+int Arm7::runUntil(u64 deadline)
 {
-    switch (reg)
+    u64 start = scheduler->cycles;
+
+    do
     {
-        case r0: return registers.r0;
-        case r1: return registers.r1;
-        case r2: return registers.r2;
-        case r3: return registers.r3;
-        case r4: return registers.r4;
-        case r5: return registers.r5;
-        case r6: return registers.r6;
-        case r7: return registers.r7;
-
-        case r8:
-            switch (getMode())
-            {
-                case Mode::FIQ: return registers.r8_fiq;
-                default: return registers.r8;
-            }
-        case r9:
-            switch (getMode())
-            {
-                case Mode::FIQ: return registers.r9_fiq;
-                default: return registers.r9;
-            }
-        case r10:
-            switch (getMode())
-            {
-                case Mode::FIQ: return registers.r10_fiq;
-                default: return registers.r10;
-            }
-        case r11:
-            switch (getMode())
-            {
-                case Mode::FIQ: return registers.r11_fiq;
-                default: return registers.r11;
-            }
-        case r12:
-            switch (getMode())
-            {
-                case Mode::FIQ: return registers.r12_fiq;
-                default: return registers.r12;
-            }
+        fetch();
+        decode();
+        scheduler->cycles += execute(pipeline[0].opcode);
 
-        case r13:
-            switch(getMode())
-            {
-                case Mode::USR:
-                case Mode::SYS: return registers.r13;
-                case Mode::FIQ: return registers.r13_fiq;
-                case Mode::SVC: return registers.r13_svc;
-                case Mode::ABT: return registers.r13_abt;
-                case Mode::IRQ: return registers.r13_irq;
-                case Mode::UND: return registers.r13_und;
-            }
+        // update pipeline
+        pipeline[0] = pipeline[1];
+        pipeline[1] = pipeline[2];
+    } while (scheduler->cycles < deadline && !scheduler->due() && !interruptPending() && !halted() && !idle_loop && !(in_interrupt && registers.r[15] == 0x138));
 
-        case r14:
-            switch(getMode())
-            {
-                case Mode::USR:
-                case Mode::SYS: return registers.r14;
-                case Mode::FIQ: return registers.r14_fiq;
-                case Mode::SVC: return registers.r14_svc;
-                case Mode::ABT: return registers.r14_abt;
-                case Mode::IRQ: return registers.r14_irq;
-                case Mode::UND: return registers.r14_und;
-            }
+    skipIdleLoop(deadline);
+    return scheduler->cycles - start;
+}
+
+/*
+ * Cached interpreter - execute the pre-decoded block at the current pc.
+ * Returns the number of cycles elapsed once a branch is taken, the block ends,
+ * an event is due, an interrupt becomes pending or at least budget cycles have passed.
+ * The scheduler clock moves as in runUntil.
+ */
+int Arm7::runBlock(int budget)
+{
+    u64 start    = scheduler->cycles;
+    u64 deadline = start + budget;
+
+    State state = getState();
+    u32 width = state == State::ARM ? 4 : 2;
+
+    // refill the pipeline after a branch
+    if (!pipeline_full)
+    {
+        registers.r[15] += 2 * width;
+        pipeline_full = true;
+    }
+
+    u32 pc = registers.r[15] - 2 * width;
+
+    // only aligned code in the BIOS, RAM and cart ROM is cached, interpret anything else
+    u32 region = pc >> 24;
+    bool cacheable = pc <= MEM_BIOS_END || region == 0x2 || region == 0x3 || (region >= 0x8 && region <= 0xD);
+
+    if (!cacheable || (pc & (width - 1)) != 0)
+    {
+        registers.r[15] = pc;
+        pipeline_full = false;
+        fetch();
+        scheduler->cycles += execute(pipeline[0].opcode);
+        return scheduler->cycles - start;
+    }
+
+    Block *block = block_cache.find(pc, state);
+    if (!block)
+        block = &compileBlock(pc, state);
+
+    if (jit_enabled)
+    {
+        if (!block->code)
+            block->code = jit.compile(*this, *block, state);
+
+        // out of room for native code, start over with an empty cache
+        if (!block->code && jit.full())
+        {
+            block_cache.clear();
+            jit.reset();
+
+            block = &compileBlock(pc, state);
+            block->code = jit.compile(*this, *block, state);
+        }
+
+        if (block->code)
+        {
+            jit_generation = block_cache.generation;
+            jit_start      = start;
+            jit_deadline   = deadline;
+
+            // native code updates the cpsr flags directly
+            resolveFlags();
+
+            // inline instructions never change whether an interrupt is pending,
+            // so stop after the first instruction here just like the loop below would
+            scheduler->cycles = start + block->code(interruptPending() ? 0 : budget);
+
+            skipIdleLoop(deadline);
+            return scheduler->cycles - start;
+        }
+    }
+
+    u32 generation = block_cache.generation;
+
+    for (auto const &op : block->ops)
+    {
+        // fetches from the BIOS update the value returned for protected BIOS reads
+        if (state == State::ARM && op.address + 8 < MEM_BIOS_END)
+            last_read_bios = mem->read32Unsafe(op.address + 8);
+
+        pipeline[0] = { op.opcode, op.address };
+        scheduler->cycles += execute(op, state);
+
+        // branch taken, or the block itself was overwritten
+        if (!pipeline_full || block_cache.generation != generation || getState() != state)
+            break;
+
+        // out of budget, or the instruction scheduled an event that is already due
+        if (scheduler->cycles >= deadline || scheduler->due())
+            break;
+
+        // the last instruction may have requested or enabled an interrupt, or halted the cpu
+        if (interruptPending() || halted())
+            break;
+    }
+
+    skipIdleLoop(deadline);
+    return scheduler->cycles - start;
+}
+
+// move guest memory into the fastmem arena, false if the host doesn't support it
+bool Arm7::enableFastmem()
+{
+    fastmem_enabled = Fastmem::supported && fastmem.init(mem, &Arm7::fastmemRead, &Arm7::fastmemWrite, this);
+    return fastmem_enabled;
+}
+
+// nothing can change until the next event, so an idle loop would just spin until then or until deadline
+void Arm7::skipIdleLoop(u64 deadline)
+{
+    if (!idle_loop)
+        return;
+
+    idle_loop = false;
+
+    if (!scheduler->due())
+        scheduler->cycles = std::max(scheduler->cycles, std::min(deadline, scheduler->cycles + scheduler->cyclesUntilNextEvent()));
+}
 
-        case r15:
-            return registers.r15; // all banks share r15
+/*
+ * Called by backward branches, flags the loop they close if it only polls memory.
+ * Interrupts are checked first so a pending one is never skipped over.
+ */
+void Arm7::checkIdleLoop(u32 target)
+{
+    u32 branch = pipeline[0].address;
+
+    if (target < branch && !interruptPending())
+        idle_loop = idle_loops.isIdle(mem, branch, target, getState(), registers.r);
+}
+
+bool Arm7::interruptPending()
+{
+    return (irq->getIE() & irq->getIF()) && irq->isEnabled() && registers.cpsr.i == 0;
+}
+
+/*
+ * Called from native code for every instruction the jit doesn't emit inline, with the cycles elapsed in the block so far.
+ * Returns the cycles taken, complemented if the block has to be left for the same reasons as in runBlock,
+ * or because the instruction scheduled an event that comes before the end of the budget.
+ */
+int Arm7::jitStep(Arm7 *cpu, MicroOp const *op, int elapsed)
+{
+    State state = cpu->getState();
+
+    if (state == State::ARM && op->address + 8 < MEM_BIOS_END)
+        cpu->last_read_bios = cpu->mem->read32Unsafe(op->address + 8);
+
+    // inline instructions only count their cycles, catch the clock up for anything that reads it
+    Scheduler *scheduler = cpu->scheduler;
+    scheduler->cycles = cpu->jit_start + elapsed;
+
+    cpu->pipeline[0] = { op->opcode, op->address };
+    int cycles = cpu->execute(*op, state);
+    scheduler->cycles += cycles;
+
+    // native code updates the cpsr flags directly
+    cpu->resolveFlags();
+
+    bool event = scheduler->due() || scheduler->cycles + scheduler->cyclesUntilNextEvent() < cpu->jit_deadline;
+
+    if (!cpu->pipeline_full || cpu->block_cache.generation != cpu->jit_generation || cpu->getState() != state || cpu->interruptPending() || cpu->halted() || event)
+        return ~cycles;
+
+    return cycles;
+}
+
+// decode instructions from pc until an unconditional branch or the end of the page
+Block &Arm7::compileBlock(u32 pc, State state)
+{
+    Block block;
+    u32 address = pc;
+
+    do
+    {
+        MicroOp op;
+        bool branch;
+
+        op.address = address;
+
+        if (state == State::ARM)
+        {
+            op.opcode = read32(address);
+            op.arm    = arm_lut[(op.opcode >> 16 & 0xFF0) | (op.opcode >> 4 & 0xF)];
+            address  += 4;
+
+            branch = (op.opcode >> 28) == 0xE && (
+                (op.opcode & 0x0E000000) == 0x0A000000 || // B, BL
+                (op.opcode & 0x0FFFFFF0) == 0x012FFF10 || // BX
+                (op.opcode & 0x0F000000) == 0x0F000000);  // SWI
+        }
+
+        else
+        {
+            op.opcode = read16(address);
+            op.thumb  = thumb_lut[op.opcode >> 6 & 0x3FF];
+            address  += 2;
+
+            branch = (op.opcode & 0xF800) == 0xE000 || // B
+                     (op.opcode & 0xF800) == 0xF800 || // BL (second half)
+                     (op.opcode & 0xFF80) == 0x4700 || // BX
+                     (op.opcode & 0xFF00) == 0xDF00 || // SWI
+                     (op.opcode & 0xFF00) == 0xBD00;   // POP {..., pc}
+        }
+
+        block.ops.push_back(op);
+
+        if (branch)
+            break;
+    } while (address % BlockCache::PAGE_SIZE != 0);
+
+    return block_cache.insert(pc, state, std::move(block));
+}
+
+// execute a decoded instruction, see Arm7::execute(u32)
+int Arm7::execute(MicroOp const &op, State state)
+{
+    cycles = 0;
+
+    if (state == State::ARM)
+    {
+        if (!conditionMet((Condition) util::bitseq<31, 28>(op.opcode)))
+        {
+            incrementPC();
+            tick(0, 0, 1); // 1I
+            return cycles;
+        }
+
+        (this->*op.arm)(op.opcode);
+    }
+
+    else
+    {
+        (this->*op.thumb)(static_cast<u16>(op.opcode));
+    }
+
+    // increment pc if there was no branch
+    if (pipeline_full)
+        incrementPC();
+
+    return cycles;
+}
+
+u32 Arm7::getStatusRegister(u32 reg)
+{
+    resolveFlags();
+
+    switch (reg)
+    {
         case cpsr:
             return registers.cpsr.raw; // all banks share cpsr
         case spsr:
@@ -353,210 +537,173 @@ u32 Arm7::getRegister(u32 reg)
     return -1;
 }
 
-void Arm7::setRegister(u32 reg, u32 val)
+void Arm7::setStatusRegister(u32 reg, u32 val)
 {
     switch (reg)
     {
-        // all banks share r0 - r7
-        case r0: registers.r0 = val; break;
-        case r1: registers.r1 = val; break;
-        case r2: registers.r2 = val; break;
-        case r3: registers.r3 = val; break;
-        case r4: registers.r4 = val; break;
-        case r5: registers.r5 = val; break;
-        case r6: registers.r6 = val; break;
-        case r7: registers.r7 = val; break;
-
-        // banked registers
-        case r8:
-            switch (getMode())
-            {
-                case Mode::FIQ:
-                    registers.r8_fiq = val;
-                    break;
-                default:
-                    registers.r8 = val;
-                    break;
-            }
-            break;
-        case r9:
-            switch (getMode())
-            {
-                case Mode::FIQ:
-                    registers.r9_fiq = val;
-                    break;
-                default:
-                    registers.r9 = val;
-                    break;
-            }
-            break;
-        case r10:
-            switch (getMode())
-            {
-                case Mode::FIQ:
-                    registers.r10_fiq = val;
-                    break;
-                default:
-                    registers.r10 = val;
-                    break;
-            }
-            break;
-        case r11:
-            switch (getMode())
-            {
-                case Mode::FIQ:
-                    registers.r11_fiq = val;
-                    break;
-                default:
-                    registers.r11 = val;
-                    break;
-            }
-            break;
-        case r12:
-            switch (getMode())
-            {
-                case Mode::FIQ:
-                    registers.r12_fiq = val;
-                    break;
-                default:
-                    registers.r12 = val;
-                    break;
-            }
+        // all banks share cpsr
+        case cpsr:
+        {
+            Mode old_mode = getMode();
+            registers.cpsr.raw = val;
+            lazy_flags.op = LazyFlags::NONE;
+            switchBank(old_mode, getMode());
             break;
+        }
 
-        case r13:
-            switch(getMode())
-            {
-                case Mode::USR:
-                case Mode::SYS:
-                    registers.r13 = val;
-                    break;
-                case Mode::FIQ:
-                    registers.r13_fiq = val;
-                    break;
-                case Mode::SVC:
-                    registers.r13_svc = val;
-                    break;
-                case Mode::ABT:
-                    registers.r13_abt = val;
-                    break;
-                case Mode::IRQ:
-                    registers.r13_irq = val;
-                    break;
-                case Mode::UND:
-                    registers.r13_und = val;
-                    break;
-            }
-            break;
+        default:
+            assert(!"Error: unknown register in Arm7::setRegister");
+    }
+}
 
-        case r14:
-            switch(getMode())
-            {
-                case Mode::USR:
-                case Mode::SYS:
-                    registers.r14 = val;
-                    break;
-                case Mode::FIQ:
-                    registers.r14_fiq = val;
-                    break;
-                case Mode::SVC:
-                    registers.r14_svc = val;
-                    break;
-                case Mode::ABT:
-                    registers.r14_abt = val;
-                    break;
-                case Mode::IRQ:
-                    registers.r14_irq = val;
-                    break;
-                case Mode::UND:
-                    registers.r14_und = val;
-                    break;
-            }
-            break;
+/*
+ * Moves the banked registers of old_mode out of the register file and those of new_mode in.
+ * r8 - r12 are only banked in fiq mode, r13 and r14 in every mode but user and system.
+ */
+void Arm7::switchBank(Mode old_mode, Mode new_mode)
+{
+    u32 *r = registers.r;
 
+    if (old_mode == new_mode)
+        return;
 
-        case r15:  registers.r15      = val; break; // all banks share r15
-        case cpsr: registers.cpsr.raw = val; break; // all banks share cpsr
-        default:
-            assert(!"Error: unknown register in Arm7::setRegister");
+    // save outgoing bank
+    if (old_mode == Mode::FIQ)
+    {
+        registers.r8_fiq  = r[8];
+        registers.r9_fiq  = r[9];
+        registers.r10_fiq = r[10];
+        registers.r11_fiq = r[11];
+        registers.r12_fiq = r[12];
+    }
+
+    else
+    {
+        registers.r8_usr  = r[8];
+        registers.r9_usr  = r[9];
+        registers.r10_usr = r[10];
+        registers.r11_usr = r[11];
+        registers.r12_usr = r[12];
+    }
+
+    switch (old_mode)
+    {
+        case Mode::USR:
+        case Mode::SYS: registers.r13_usr = r[13]; registers.r14_usr = r[14]; break;
+        case Mode::FIQ: registers.r13_fiq = r[13]; registers.r14_fiq = r[14]; break;
+        case Mode::SVC: registers.r13_svc = r[13]; registers.r14_svc = r[14]; break;
+        case Mode::ABT: registers.r13_abt = r[13]; registers.r14_abt = r[14]; break;
+        case Mode::IRQ: registers.r13_irq = r[13]; registers.r14_irq = r[14]; break;
+        case Mode::UND: registers.r13_und = r[13]; registers.r14_und = r[14]; break;
+    }
+
+    // load incoming bank
+    if (new_mode == Mode::FIQ)
+    {
+        r[8]  = registers.r8_fiq;
+        r[9]  = registers.r9_fiq;
+        r[10] = registers.r10_fiq;
+        r[11] = registers.r11_fiq;
+        r[12] = registers.r12_fiq;
+    }
+
+    else
+    {
+        r[8]  = registers.r8_usr;
+        r[9]  = registers.r9_usr;
+        r[10] = registers.r10_usr;
+        r[11] = registers.r11_usr;
+        r[12] = registers.r12_usr;
+    }
+
+    switch (new_mode)
+    {
+        case Mode::USR:
+        case Mode::SYS: r[13] = registers.r13_usr; r[14] = registers.r14_usr; break;
+        case Mode::FIQ: r[13] = registers.r13_fiq; r[14] = registers.r14_fiq; break;
+        case Mode::SVC: r[13] = registers.r13_svc; r[14] = registers.r14_svc; break;
+        case Mode::ABT: r[13] = registers.r13_abt; r[14] = registers.r14_abt; break;
+        case Mode::IRQ: r[13] = registers.r13_irq; r[14] = registers.r14_irq; break;
+        case Mode::UND: r[13] = registers.r13_und; r[14] = registers.r14_und; break;
     }
 }
 
-// update cpsr flags after a logical operation
+// record the flags of a logical operation, N and Z come from the result and C from the barrel shifter
 void Arm7::updateFlagsLogical(u32 result, u8 carry_out)
 {
-    // C flag will be set to the carry out from the barrel shifter
-    setConditionCodeFlag(ConditionFlag::C, carry_out);
+    // logical ops leave V alone, so a pending arithmetic V has to land first
+    if (lazy_flags.op != LazyFlags::LOGICAL)
+        resolveFlags();
 
-    // Z flag will be set if and only if the result is all zeros
-    uint8_t new_z = result == 0 ? 1 : 0;
-    setConditionCodeFlag(ConditionFlag::Z, new_z);
-
-    // N flag will be set to the logical value of bit 31 of the result
-    uint8_t new_n = result & 0x80000000 ? 1 : 0;
-    setConditionCodeFlag(ConditionFlag::N, new_n); // 0x80000000 is 1 followed by 31 zeros in binary
+    lazy_flags.op     = LazyFlags::LOGICAL;
+    lazy_flags.carry  = carry_out;
+    lazy_flags.result = result;
 }
 
-// update cpsr flags after an addition operation
+// record the flags of an addition operation
 void Arm7::updateFlagsAddition(u32 op1, u32 op2, u32 result)
 {
-    // C flag will be set to the carry out of bit 31 of the ALU
-    if (op1 > result || op2 > result)
-        setConditionCodeFlag(ConditionFlag::C, 1);
-    else
-        setConditionCodeFlag(ConditionFlag::C, 0);
+    lazy_flags.op     = LazyFlags::ADDITION;
+    lazy_flags.op1    = op1;
+    lazy_flags.op2    = op2;
+    lazy_flags.result = result;
+}
 
-    // Z flag will be set if and only if the result was zero
-    u8 new_z = result == 0 ? 1 : 0;
-    setConditionCodeFlag(ConditionFlag::Z, new_z);
+// record the flags of a subtraction operation
+void Arm7::updateFlagsSubtraction(u32 op1, u32 op2, u32 result)
+{
+    lazy_flags.op     = LazyFlags::SUBTRACTION;
+    lazy_flags.op1    = op1;
+    lazy_flags.op2    = op2;
+    lazy_flags.result = result;
+}
 
-    // N flag will be set to the value of bit 31 of the result
-    u8 new_n = result & 0x80000000 ? 1 : 0;
-    setConditionCodeFlag(ConditionFlag::N, new_n); // 0x80000000 is 1 followed by 31 zeros in binary
+// write the flags of the last recorded ALU op to the cpsr
+void Arm7::materializeFlags()
+{
+    u32 op1    = lazy_flags.op1;
+    u32 op2    = lazy_flags.op2;
+    u32 result = lazy_flags.result;
+
+    // Z flag will be set if and only if the result is all zeros
+    registers.cpsr.z = result == 0 ? 1 : 0;
+
+    // N flag will be set to the logical value of bit 31 of the result
+    registers.cpsr.n = result & 0x80000000 ? 1 : 0;
 
-    // V flag will be set overflow occurs into bit 31 of the result
     u8 op1_msb    = op1    & 0x80000000 ? 1 : 0;
     u8 op2_msb    = op2    & 0x80000000 ? 1 : 0;
     u8 result_msb = result & 0x80000000 ? 1 : 0;
 
-    if (op1_msb == 0 && op2_msb == 0 && result_msb == 1)
-        setConditionCodeFlag(ConditionFlag::V, 1);
-    else if (op1_msb == 1 && op2_msb == 1 && result_msb == 0)
-        setConditionCodeFlag(ConditionFlag::V, 1);
-    else
-        setConditionCodeFlag(ConditionFlag::V, 0);
-}
+    switch (lazy_flags.op)
+    {
+        case LazyFlags::LOGICAL:
+            // C flag will be set to the carry out from the barrel shifter
+            registers.cpsr.c = lazy_flags.carry;
+            break;
 
-// update cpsr flags after a subtraction operation
-void Arm7::updateFlagsSubtraction(u32 op1, u32 op2, u32 result)
-{
-    // C flag will be set to the carry out of bit 31 of the ALU
-    // ARM uses an inverted carry flag for borrow
-    if (result > op1 || (result == op1 && op2 != 0))
-        setConditionCodeFlag(ConditionFlag::C, 0);
-    else
-        setConditionCodeFlag(ConditionFlag::C, 1);
+        case LazyFlags::ADDITION:
+            // C flag will be set to the carry out of bit 31 of the ALU
+            registers.cpsr.c = op1 > result || op2 > result ? 1 : 0;
 
-    // Z flag will be set if and only if the result was zero
-    uint8_t new_z = result == 0 ? 1 : 0;
-    setConditionCodeFlag(ConditionFlag::Z, new_z);
+            // V flag will be set overflow occurs into bit 31 of the result
+            registers.cpsr.v = op1_msb == op2_msb && result_msb != op1_msb ? 1 : 0;
+            break;
 
-    // N flag will be set to the value of bit 31 of the result
-    uint8_t new_n = result & 0x80000000 ? 1 : 0;
-    setConditionCodeFlag(ConditionFlag::N, new_n); // 0x80000000 is 1 followed by 31 zeros in binary
+        case LazyFlags::SUBTRACTION:
+            // C flag will be set to the carry out of bit 31 of the ALU
+            // ARM uses an inverted carry flag for borrow
+            registers.cpsr.c = result > op1 || (result == op1 && op2 != 0) ? 0 : 1;
 
-    // V flag will be set overflow occurs into bit 31 of the result
-    u8 op1_msb    =    op1 & 0x80000000 ? 1 : 0;
-    u8 op2_msb    =    op2 & 0x80000000 ? 1 : 0;
-    u8 result_msb = result & 0x80000000 ? 1 : 0;
+            // V flag will be set overflow occurs into bit 31 of the result
+            registers.cpsr.v = op1_msb != op2_msb && result_msb != op1_msb ? 1 : 0;
+            break;
 
-    if (op1_msb == 0 && op2_msb == 1 && result_msb == 1)
-        setConditionCodeFlag(ConditionFlag::V, 1);
-    else if (op1_msb == 1 && op2_msb == 0 && result_msb == 0)
-        setConditionCodeFlag(ConditionFlag::V, 1);
-    else
-        setConditionCodeFlag(ConditionFlag::V, 0);
+        default:
+            break;
+    }
 
+    lazy_flags.op = LazyFlags::NONE;
 }
 
 /* performs a shift operation on op2.
@@ -651,7 +798,7 @@ u8 Arm7::barrelShift(u32 shift_amount, u32 &num, u8 opcode)
 
 inline void Arm7::incrementPC()
 {
-    registers.r15 += getState() == State::ARM ? 4 : 2;
+    registers.r[15] += getState() == State::ARM ? 4 : 2;
 }
 
 /*
@@ -663,6 +810,9 @@ void Arm7::updateCPSR(u32 value, bool flags_only)
     StatusRegister sr;
     sr.raw = value;
 
+    // every flag is overwritten, so whatever is still pending is dropped
+    lazy_flags.op = LazyFlags::NONE;
+
     // in user mode, only condition bits can be changed
     if (flags_only || getMode() == Mode::USR)
     {
@@ -673,6 +823,7 @@ void Arm7::updateCPSR(u32 value, bool flags_only)
         return;
     }
 
+    Mode old_mode = getMode();
     registers.cpsr.raw = value;
 
     if (registers.cpsr.t != sr.t)
@@ -681,6 +832,8 @@ void Arm7::updateCPSR(u32 value, bool flags_only)
     // validate CPSR wasn't given an invalid state
     assert(getMode());
 
+    switchBank(old_mode, getMode());
+
     // if (sr.state == IRQ && registers.cpsr.i == 1) return; // irq disabled bit set
     // if (sr.state == FIQ && registers.cpsr.f == 1) return; // fiq disabled bit set
 }
@@ -692,6 +845,9 @@ void Arm7::updateSPSR(u32 value, bool flags_only)
 {
     StatusRegister old_spsr;
 
+    // spsr is the cpsr in system mode
+    resolveFlags();
+
     // get spsr_<mode>
     switch (getMode())
     {
@@ -743,27 +899,23 @@ void Arm7::updateSPSR(u32 value, bool flags_only)
     }
 }
 
-// advances the cpu clock
-// address is the current access address
-// type is the cycle type, either 'n', 's', or 'i'
+// advances the cpu clock by n nonsequential, s sequential and i internal cycles
+// the accesses are code fetches, timed by the region the code runs from
 void Arm7::tick(u8 n, u8 s, u8 i)
 {
-    u16 access_cycles = 0;
+    u32 pc   = registers.r[r15];
+    bool word = getState() == State::ARM;
 
-    // non-sequential wait states
-    for (int x = 0; x < n; ++x)
-        access_cycles += 1 + mem->n_cycles; // 1 + N waitstates
-    
-    // sequential wait states
-    for (int x = 0; x < s; ++x)
-        access_cycles += 1 + mem->s_cycles; // 1 + S waitstates
-    
-    // internal cycle
-    for (int x = 0; x < i; ++x)
-        access_cycles += 1; // 1 cycle
-    
-    // keep running total of cycles
-    cycles += access_cycles;
+    cycles += n * mem->accessCycles(pc, word, false)
+            + s * mem->accessCycles(pc, word, true)
+            + i;
+}
+
+// advances the cpu clock by n nonsequential and s sequential data accesses, timed by the region of address
+void Arm7::tickData(u32 address, bool word, u8 n, u8 s)
+{
+    cycles += n * mem->accessCycles(address, word, false)
+            + s * mem->accessCycles(address, word, true);
 }
 
 void Arm7::handleInterrupt()
@@ -907,8 +1059,18 @@ int i = 0xFFFF;
 
 u32 Arm7::read8(u32 address)
 {
+    return load8(address);
+}
+
+// reads from the bus without fastmem, and the ones that fault out of it
+u32 Arm7::busRead8(u32 address)
+{
+    // RAM and ROM have no special cases, read them straight from the page table
+    if (address > MEM_BIOS_END && mem->readPage(address))
+        return mem->read8(address);
+
     // reading from BIOS memory
-    if (address <= 0x3FFF && registers.r15 > 0x3FFF)
+    if (address <= 0x3FFF && registers.r[15] > 0x3FFF)
     {
         log(LogLevel::Error, "Invalid read from BIOS u8: {0:#x}\n", last_read_bios);
         return last_read_bios & 0xFF;
@@ -930,75 +1092,11 @@ u32 Arm7::read8(u32 address)
  */
 u32 Arm7::read16(u32 address, bool sign)
 {
-    // reading from BIOS memory
-    if (address <= 0x3FFF && registers.r15 > 0x3FFF)
-    {
-        //log(LogLevel::Error, "Invalid read from BIOS u16: 0x{x}\n", last_read_bios);
-
-        u32 value = last_read_bios;
-        return value & 0xFFFF;
-    }
-
-    bool valid = true;
-
-    switch (address)
-    {
-        case REG_BG0HOFS:
-        case REG_BG1HOFS:
-        case REG_BG2HOFS:
-        case REG_BG3HOFS:
-        case REG_BG0VOFS:
-        case REG_BG1VOFS:
-        case REG_BG2VOFS:
-        case REG_BG3VOFS:
-        case REG_BG2X:
-        case REG_BG2Y:
-        case REG_BG2X + 2:
-        case REG_BG2Y + 2:
-        case REG_BG2PA:
-        case REG_BG2PB:
-        case REG_BG2PC:
-        case REG_BG2PD:
-        case REG_BG3X:
-        case REG_BG3Y:
-        case REG_BG3X + 2:
-        case REG_BG3Y + 2:
-        case REG_BG3PA:
-        case REG_BG3PB:
-        case REG_BG3PC:
-        case REG_BG3PD:
-        case REG_WIN0H:
-        case REG_WIN1H:
-        case REG_WIN0V:
-        case REG_WIN1V:
-        case REG_MOSAIC:
-        case REG_MOSAIC + 2:
-        case REG_DMA0SAD:
-        case REG_DMA0DAD:
-        case REG_DMA0CNT:
-        case REG_DMA1SAD:
-        case REG_DMA1DAD:
-        case REG_DMA1CNT:
-        case REG_DMA2SAD:
-        case REG_DMA2DAD:
-        case REG_DMA2CNT:
-        case REG_DMA3SAD:
-        case REG_DMA3DAD:
-        case REG_DMA3CNT:
-            return readUnused(address);
-    }
-
-    if ((address >= 0x4000 && address <= 0x1FFFFFF) || address >= 0x10000000)
-    {
-        std::cout << "UNUSED U16\n";
-        return readUnused(address);
-    }
-
     u32 data;
 
     if (sign)
     {
-        data = (u32) mem->read16(address);
+        data = load16(address);
 
         // misaligned address, sign extend BYTE value
         if ((address & 1) != 0)
@@ -1018,7 +1116,7 @@ u32 Arm7::read16(u32 address, bool sign)
     else
     {
         // read from forcibly aligned address
-        data = (u32) mem->read16(address & ~1);
+        data = load16(address & ~1);
         // misaligned read - reads from forcibly aligned address "addr AND 1", and does then rotate the data as "ROR 8"
         if ((address & 1) != 0)
             barrelShift(8, data, 0b11);
@@ -1034,33 +1132,8 @@ u32 Arm7::read16(u32 address, bool sign)
  */
 u32 Arm7::read32(u32 address, bool ldr)
 {
-    // reading from BIOS memory
-    if (address <= 0x3FFF)
-    {
-
-        if (registers.r15 < 0x3FFF)
-            last_read_bios = mem->read32Unsafe(address);
-        
-        return last_read_bios;
-    }
-
-    switch (address)
-    {
-        [[unlikely]] case REG_DMA0CNT:
-        [[unlikely]] case REG_DMA1CNT:
-        [[unlikely]] case REG_DMA2CNT:
-        [[unlikely]] case REG_DMA3CNT:
-            return mem->read32Unsafe(address) & 0x00FFFFFF; // return 0 for unused byte 0x40000XE
-    }
-
-    if ((address >= 0x4000 && address <= 0x1FFFFFF) || address >= 0x10000000)
-    {
-        std::cout << "UNUSED U32\n";
-        return readUnused(address);
-    }
-    
     // read from forcibly aligned address
-    u32 data = mem->read32(address & ~3);
+    u32 data = load32(address & ~3);
 
     // misaligned read - reads from forcibly aligned address "addr AND (NOT 3)", and does then rotate the data as "ROR (addr AND 3)*8"
     // only used for LDR and SWP operations, otherwise just use data from forcibly aligned address
@@ -1075,6 +1148,134 @@ u32 Arm7::read32(u32 address, bool ldr)
 }
 
 
+u32 Arm7::busRead16(u32 address)
+{
+    // RAM and ROM have no special cases, so only other regions need the checks below
+    if (address <= MEM_BIOS_END || !mem->readPage(address))
+    {
+        // reading from BIOS memory
+        if (address <= 0x3FFF && registers.r[15] > 0x3FFF)
+        {
+            //log(LogLevel::Error, "Invalid read from BIOS u16: 0x{x}\n", last_read_bios);
+
+            u32 value = last_read_bios;
+            return value & 0xFFFF;
+        }
+
+        switch (address)
+        {
+            case REG_BG0HOFS:
+            case REG_BG1HOFS:
+            case REG_BG2HOFS:
+            case REG_BG3HOFS:
+            case REG_BG0VOFS:
+            case REG_BG1VOFS:
+            case REG_BG2VOFS:
+            case REG_BG3VOFS:
+            case REG_BG2X:
+            case REG_BG2Y:
+            case REG_BG2X + 2:
+            case REG_BG2Y + 2:
+            case REG_BG2PA:
+            case REG_BG2PB:
+            case REG_BG2PC:
+            case REG_BG2PD:
+            case REG_BG3X:
+            case REG_BG3Y:
+            case REG_BG3X + 2:
+            case REG_BG3Y + 2:
+            case REG_BG3PA:
+            case REG_BG3PB:
+            case REG_BG3PC:
+            case REG_BG3PD:
+            case REG_WIN0H:
+            case REG_WIN1H:
+            case REG_WIN0V:
+            case REG_WIN1V:
+            case REG_MOSAIC:
+            case REG_MOSAIC + 2:
+            case REG_DMA0SAD:
+            case REG_DMA0DAD:
+            case REG_DMA0CNT:
+            case REG_DMA1SAD:
+            case REG_DMA1DAD:
+            case REG_DMA1CNT:
+            case REG_DMA2SAD:
+            case REG_DMA2DAD:
+            case REG_DMA2CNT:
+            case REG_DMA3SAD:
+            case REG_DMA3DAD:
+            case REG_DMA3CNT:
+                return readUnused(address);
+        }
+
+        if ((address >= 0x4000 && address <= 0x1FFFFFF) || address >= 0x10000000)
+        {
+            std::cout << "UNUSED U16\n";
+            return readUnused(address);
+        }
+    }
+
+    return mem->read16(address);
+}
+
+u32 Arm7::busRead32(u32 address)
+{
+    // RAM and ROM have no special cases, so only other regions need the checks below
+    if (address <= MEM_BIOS_END || !mem->readPage(address))
+    {
+        // reading from BIOS memory
+        if (address <= 0x3FFF)
+        {
+
+            if (registers.r[15] < 0x3FFF)
+                last_read_bios = mem->read32Unsafe(address);
+        
+            return last_read_bios;
+        }
+
+        switch (address)
+        {
+            [[unlikely]] case REG_DMA0CNT:
+            [[unlikely]] case REG_DMA1CNT:
+            [[unlikely]] case REG_DMA2CNT:
+            [[unlikely]] case REG_DMA3CNT:
+                return mem->read32Unsafe(address) & 0x00FFFFFF; // return 0 for unused byte 0x40000XE
+        }
+
+        if ((address >= 0x4000 && address <= 0x1FFFFFF) || address >= 0x10000000)
+        {
+            std::cout << "UNUSED U32\n";
+            return readUnused(address);
+        }
+    }
+
+    return mem->read32(address);
+}
+
+// fastmem fault handlers, for everything that isn't RAM or ROM
+u32 Arm7::fastmemRead(void *cpu, u32 address, int size)
+{
+    auto *arm = static_cast<Arm7 *>(cpu);
+
+    switch (size)
+    {
+        case 1:  return arm->busRead8(address);
+        case 2:  return arm->busRead16(address);
+        default: return arm->busRead32(address);
+    }
+}
+
+void Arm7::fastmemWrite(void *cpu, u32 address, u32 value, int size)
+{
+    auto *arm = static_cast<Arm7 *>(cpu);
+
+    if (size == 2)
+        arm->mem->write16(address, value);
+    else
+        arm->mem->write32(address, value);
+}
+
 void Arm7::write8(u32 address, u8 value)
 {
     if (!memCheckWrite(address)) return;
@@ -1138,6 +1339,15 @@ void Arm7::write16(u32 address, u16 value)
     address &= ~0x1;
 
     if (!memCheckWrite(address)) return;
+
+    if (fastmem_enabled)
+    {
+        fastmem.write16(address, value);
+
+        mem->invalidate(address);
+        return;
+    }
+
     mem->write16(address, value);
 }
 
@@ -1151,6 +1361,15 @@ void Arm7::write32(u32 address, u32 value)
     // 8 cycles for gamepak rom access, 5 from mem_check and 3 here
     // if (address >= MEM_GAMEPAK_ROM_START && address <= MEM_GAMEPAK_ROM_END)
     //     cycles += 3;
+
+    if (fastmem_enabled)
+    {
+        fastmem.write32(address, value);
+
+        mem->invalidate(address);
+        return;
+    }
+
     mem->write32(address, value);
 }
 
@@ -1170,7 +1389,7 @@ inline bool Arm7::memCheckRead(u32 &address)
     // // bios read
     // if (address <= 0x3FFF)
     // {
-    //     if (registers.r15 >= 0x3FFF)
+    //     if (registers.r[15] >= 0x3FFF)
     //         return false;
         
     //     last_read_bios = mem->read_u32_unprotected(address);
@@ -1301,6 +1520,8 @@ bool Arm7::checkState()
 }
 
 void Arm7::print() {
+    resolveFlags();
+
     std::cout<< std::hex <<"R0 : 0x" << std::setw(8) << std::setfill('0') << getRegister(0) << 
 				" -- R4  : 0x" << std::setw(8) << std::setfill('0') << getRegister(4) << 
 				" -- R8  : 0x" << std::setw(8) << std::setfill('0') << getRegister(8) << 
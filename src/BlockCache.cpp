@@ -0,0 +1,60 @@
+/* discovery
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ *
+ * FILE: BlockCache.cpp
+ * DATE: October 16th, 2026
+ * DESCRIPTION: cache of pre-decoded blocks of guest code for the cached interpreter
+ */
+#include "BlockCache.h"
+
+BlockCache::BlockCache()
+{
+    generation = 0;
+}
+
+Block *BlockCache::find(u32 pc, State state)
+{
+    auto iter = blocks.find(key(pc, state));
+    return iter == blocks.end() ? nullptr : &iter->second;
+}
+
+Block &BlockCache::insert(u32 pc, State state, Block &&block)
+{
+    u32 k = key(pc, state);
+    Block &cached = blocks[k] = std::move(block);
+
+    // remember which RAM page the block was decoded from
+    // blocks from the BIOS and cart ROM are never written to, so they aren't tracked
+    int page = getPage(pc);
+
+    if (page >= 0)
+    {
+        page_blocks[page].push_back(k);
+        code_pages[page] = true;
+    }
+
+    return cached;
+}
+
+void BlockCache::clear()
+{
+    blocks.clear();
+
+    for (auto &keys : page_blocks)
+        keys.clear();
+
+    code_pages.reset();
+    ++generation;
+}
+
+// the page was written to, so every block decoded from it is stale
+void BlockCache::drop(int page)
+{
+    for (u32 k : page_blocks[page])
+        blocks.erase(k);
+
+    page_blocks[page].clear();
+    code_pages[page] = false;
+    ++generation;
+}
@@ -10,6 +10,8 @@
 
 #include <iostream>
 #include <iomanip>
+#include <algorithm>
+#include <utility>
 
 #include "Discovery.h"
 #include "util.h"
@@ -27,8 +29,8 @@ Discovery::Discovery()
     scheduler = new Scheduler();
     timer     = new Timer(scheduler);
 
-    mem       = new Memory(stat, timer, gamepad);
-    cpu       = new Arm7(mem);
+    mem       = new Memory(stat, timer, gamepad, scheduler);
+    cpu       = new Arm7(mem, scheduler);
     ppu       = new PPU(mem, stat, scheduler);
     //apu     = new APU(mem);
     irq       = new IRQ();
@@ -50,9 +52,22 @@ void Discovery::parseArgs()
             config::bios_name = argv[++i];
         else if ((argv[i] == "-c" || argv[i] == "--config") && i != argv.size()-1)
             config::config_file = argv[++i];
+        else if (argv[i] == "--cached")
+            config::cached_interpreter = true;
+        else if (argv[i] == "--jit")
+            config::jit = true;
+        else if (argv[i] == "--fastmem")
+            config::fastmem = true;
+        else if (argv[i] == "--no-idle-skip")
+            config::idle_loop_skip = false;
 		    else if ((argv[i] == "-h" || argv[i] == "--help") && i == 0)
 			      config::show_help = true;
     }
+
+    if (config::jit && !Jit::supported)
+        log(LogLevel::Warning, "The jit needs an x86-64 host, using the cached interpreter instead\n");
+
+    cpu->jit_enabled = config::jit;
 }
 
 void Discovery::printArgHelp()
@@ -67,6 +82,14 @@ void Discovery::printArgHelp()
     log("  Specifies GBA bios file, default is 'gba_bios.bin'\n");
     log("-c, --config\n");
     log("  Specifies config file, default is 'discovery.config'\n");
+    log("--cached\n");
+    log("  Run the cpu as a cached interpreter\n");
+    log("--jit\n");
+    log("  Recompile blocks of code to native x86-64 code\n");
+    log("--fastmem\n");
+    log("  Map guest memory into host virtual memory (x86-64 Linux)\n");
+    log("--no-idle-skip\n");
+    log("  Execute busy-wait loops instead of skipping to the next event\n");
     log("-h, --help\n");
   	log("  Show help...\n");
 }
@@ -92,33 +115,52 @@ void Discovery::frame()
 
     while (cycles < 280896)
     {
-        // tick hardware (not cpu) if in halt state
-        if (mem->haltcnt)
-        {   
-            std::cout << "hi\n";
-            while ((irq->getIE() & irq->getIF()) == 0)
+        if (mem->halt_state != HaltState::RUNNING)
+        {
+            u16 wake_mask = mem->halt_state == HaltState::STOP ? IRQ_STOP_WAKE : 0xFFFF;
+
+            if ((irq->getIE() & irq->getIF() & wake_mask) == 0)
+            {
+                // the clock is stopped too, only input can wake the cpu so leave the rest of the frame to the frontend
+                if (mem->halt_state == HaltState::STOP)
+                    break;
+
+                // the cpu does nothing until an interrupt, jump straight to the next event
+                int skipped = std::min(scheduler->cyclesUntilNextEvent(), 280896 - cycles);
+                scheduler->advance(skipped);
+                cycles += skipped;
 
-            mem->haltcnt = 0;
+                // DMA doesn't cost a halted cpu anything
+                mem->dma_cycles = 0;
+                continue;
+            }
+
+            mem->halt_state = HaltState::RUNNING;
             cpu->handleInterrupt();
         }
 
-        cpu->fetch();
-        cpu->decode();
-        cycles_elapsed = cpu->execute(cpu->pipeline[0].opcode);
-        scheduler->advance(cycles_elapsed);
+        // run the cpu up to the next scheduled event, nothing else can happen before then
+        int budget = scheduler->cyclesUntilNextEvent();
 
-        cpu->handleInterrupt();
+        if (config::cached_interpreter || config::jit)
+            cycles_elapsed = cpu->runBlock(budget);
+        else
+            cycles_elapsed = cpu->runUntil(scheduler->cycles + budget);
 
-        // update pipeline
-        cpu->pipeline[0] = cpu->pipeline[1];
-        cpu->pipeline[1] = cpu->pipeline[2];
+        // the cpu moved the clock up to the event, fire it, ppu timing is driven by scheduler events
+        scheduler->advance(0);
 
-        // run hardware for as many clock cycles as cpu used
-        while (cycles_elapsed-- > 0)
+        // the cpu waits while DMA has the bus, which may start more events and transfers
+        while (mem->dma_cycles > 0)
         {
-            ++cycles;
-            ppu->tick();
+            int stalled = std::exchange(mem->dma_cycles, 0);
+            scheduler->advance(stalled);
+            cycles_elapsed += stalled;
         }
+
+        cpu->handleInterrupt();
+
+        cycles += cycles_elapsed;
     }
 
 }
@@ -0,0 +1,275 @@
+/* discovery
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ *
+ * FILE: Fastmem.cpp
+ * DATE: October 16th, 2026
+ * DESCRIPTION: guest address space mapped into host virtual memory
+ *
+ * EWRAM, IWRAM, VRAM and the cart ROM live in one shared memory file. Memory's own buffers
+ * for them are replaced by views of that file, and a 4 GB arena maps every guest address of
+ * those regions, mirrors included, onto the same file. A guest access then becomes a single
+ * host access at arena + address.
+ *
+ * Everything else in the arena (BIOS, MMIO, palette RAM, OAM, cart RAM, open bus) is left
+ * inaccessible, as is writing to ROM. Those accesses fault, and the SIGSEGV handler finds
+ * which accessor faulted from the instruction pointer, performs the access through the
+ * handlers given to init, and resumes right after the faulting instruction.
+ */
+#include "Fastmem.h"
+#include "Memory.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+// rdi holds the arena, rsi the guest address and edx the value written
+// each accessor is one load or store, followed by the label a faulting access resumes at
+asm(R"(
+    .pushsection .text
+
+    .globl fastmem_read8
+    .type  fastmem_read8, @function
+fastmem_read8:
+    movzbl (%rdi,%rsi), %eax
+fastmem_read8_end:
+    ret
+    .size  fastmem_read8, . - fastmem_read8
+
+    .globl fastmem_read16
+    .type  fastmem_read16, @function
+fastmem_read16:
+    movzwl (%rdi,%rsi), %eax
+fastmem_read16_end:
+    ret
+    .size  fastmem_read16, . - fastmem_read16
+
+    .globl fastmem_read32
+    .type  fastmem_read32, @function
+fastmem_read32:
+    movl (%rdi,%rsi), %eax
+fastmem_read32_end:
+    ret
+    .size  fastmem_read32, . - fastmem_read32
+
+    .globl fastmem_write16
+    .type  fastmem_write16, @function
+fastmem_write16:
+    movw %dx, (%rdi,%rsi)
+fastmem_write16_end:
+    ret
+    .size  fastmem_write16, . - fastmem_write16
+
+    .globl fastmem_write32
+    .type  fastmem_write32, @function
+fastmem_write32:
+    movl %edx, (%rdi,%rsi)
+fastmem_write32_end:
+    ret
+    .size  fastmem_write32, . - fastmem_write32
+
+    .popsection
+)");
+
+extern "C"
+{
+    extern u8 fastmem_read8_end[];
+    extern u8 fastmem_read16_end[];
+    extern u8 fastmem_read32_end[];
+    extern u8 fastmem_write16_end[];
+    extern u8 fastmem_write32_end[];
+}
+
+struct Accessor
+{
+    void *start;
+    void *resume;
+    int size;
+    bool write;
+};
+
+static const Accessor accessors[] =
+{
+    { (void *) &fastmem_read8,   fastmem_read8_end,   1, false },
+    { (void *) &fastmem_read16,  fastmem_read16_end,  2, false },
+    { (void *) &fastmem_read32,  fastmem_read32_end,  4, false },
+    { (void *) &fastmem_write16, fastmem_write16_end, 2, true  },
+    { (void *) &fastmem_write32, fastmem_write32_end, 4, true  },
+};
+
+// the arena faults are routed to, and whoever handled SIGSEGV before
+static Fastmem *active = nullptr;
+static struct sigaction old_action;
+
+#else
+
+// never called, fastmem can't be enabled on these hosts
+extern "C"
+{
+    u32  fastmem_read8(u8 *arena, u64 address)               { return arena[address]; }
+    u32  fastmem_read16(u8 *arena, u64 address)              { return arena[address]; }
+    u32  fastmem_read32(u8 *arena, u64 address)              { return arena[address]; }
+    void fastmem_write16(u8 *arena, u64 address, u32 value)  { arena[address] = value; }
+    void fastmem_write32(u8 *arena, u64 address, u32 value)  { arena[address] = value; }
+}
+
+#endif
+
+// offsets into the shared memory file
+constexpr u32 SHM_EWRAM    = 0x0;
+constexpr u32 SHM_IWRAM    = SHM_EWRAM + MEM_EWRAM_SIZE;
+constexpr u32 SHM_VRAM     = SHM_IWRAM + MEM_IWRAM_SIZE;
+constexpr u32 SHM_ROM      = SHM_VRAM  + MEM_VRAM_SIZE;
+constexpr u32 SHM_SIZE     = SHM_ROM   + MEM_ROM_MAX_SIZE;
+
+Fastmem::Fastmem()
+{
+    arena = nullptr;
+    fd    = -1;
+
+    read_handler  = nullptr;
+    write_handler = nullptr;
+    ctx           = nullptr;
+}
+
+Fastmem::~Fastmem()
+{
+    #if defined(__x86_64__) && defined(__linux__)
+    if (active == this)
+    {
+        sigaction(SIGSEGV, &old_action, nullptr);
+        active = nullptr;
+    }
+
+    if (arena)
+        munmap(arena, ARENA_SIZE);
+
+    if (fd >= 0)
+        close(fd);
+    #endif
+}
+
+bool Fastmem::init(Memory *mem, ReadHandler read, WriteHandler write, void *context)
+{
+    #if defined(__x86_64__) && defined(__linux__)
+    read_handler  = read;
+    write_handler = write;
+    ctx           = context;
+
+    fd = memfd_create("discovery", 0);
+    if (fd < 0 || ftruncate(fd, SHM_SIZE) != 0)
+        return false;
+
+    // Memory's buffers are page aligned, so they can be swapped for views of the file
+    // whatever they hold now is copied over first
+    struct
+    {
+        u8 *host;
+        u32 offset;
+        u32 size;
+    } buffers[] =
+    {
+        { mem->ewram,    SHM_EWRAM, MEM_EWRAM_SIZE           },
+        { mem->iwram,    SHM_IWRAM, MEM_IWRAM_SIZE           },
+        { mem->vram,     SHM_VRAM,  MEM_VRAM_SIZE            },
+        { mem->cart_rom, SHM_ROM,   (u32) mem->rom_capacity },
+    };
+
+    for (auto &buffer : buffers)
+    {
+        if (buffer.size == 0)
+            continue;
+
+        if (pwrite(fd, buffer.host, buffer.size, buffer.offset) != (ssize_t) buffer.size)
+            return false;
+
+        if (mmap(buffer.host, buffer.size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, buffer.offset) == MAP_FAILED)
+            return false;
+    }
+
+    // reserve the whole arena inaccessible, then map the regions and their mirrors into it
+    void *reserved = mmap(nullptr, ARENA_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (reserved == MAP_FAILED)
+        return false;
+
+    arena = static_cast<u8 *>(reserved);
+
+    for (u32 address = MEM_EWRAM_START; address < MEM_IWRAM_START; address += MEM_EWRAM_SIZE)
+        if (!alias(address, SHM_EWRAM, MEM_EWRAM_SIZE, true))
+            return false;
+
+    for (u32 address = MEM_IWRAM_START; address < MEM_IO_REG_START; address += MEM_IWRAM_SIZE)
+        if (!alias(address, SHM_IWRAM, MEM_IWRAM_SIZE, true))
+            return false;
+
+    // VRAM mirrors every 128 KB, with 0x6018000 - 0x601FFFF mirroring 0x6010000 - 0x6017FFF
+    for (u32 address = MEM_VRAM_START; address < MEM_OAM_START; address += 0x20000)
+    {
+        if (!alias(address,           SHM_VRAM,           0x10000, true) ||
+            !alias(address + 0x10000, SHM_VRAM + 0x10000, 0x8000,  true) ||
+            !alias(address + 0x18000, SHM_VRAM + 0x10000, 0x8000,  true))
+            return false;
+    }
+
+    // ROM images 0 - 2, writes and reads past the end of the ROM fault so Memory can handle them
+    for (u32 address = MEM_GAMEPAK_ROM_START; address < 0xE000000 && mem->rom_capacity; address += MEM_ROM_MAX_SIZE)
+        if (!alias(address, SHM_ROM, mem->rom_capacity, false))
+            return false;
+
+    struct sigaction action = {};
+    action.sa_sigaction = &Fastmem::onFault;
+    action.sa_flags     = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+
+    if (sigaction(SIGSEGV, &action, &old_action) != 0)
+        return false;
+
+    active = this;
+    return true;
+    #else
+    return false;
+    #endif
+}
+
+// map size bytes of the shared memory file at offset to a guest address in the arena
+bool Fastmem::alias(u32 address, u32 offset, u32 size, bool writable)
+{
+    #if defined(__x86_64__) && defined(__linux__)
+    int prot = PROT_READ | (writable ? PROT_WRITE : 0);
+    return mmap(arena + address, size, prot, MAP_SHARED | MAP_FIXED, fd, offset) != MAP_FAILED;
+    #else
+    return false;
+    #endif
+}
+
+#if defined(__x86_64__) && defined(__linux__)
+void Fastmem::onFault(int, siginfo_t *info, void *context)
+{
+    auto *uc = static_cast<ucontext_t *>(context);
+    greg_t *regs = uc->uc_mcontext.gregs;
+    u8 *fault = static_cast<u8 *>(info->si_addr);
+
+    if (active && fault >= active->arena && fault < active->arena + ARENA_SIZE)
+    {
+        for (auto const &accessor : accessors)
+        {
+            if (regs[REG_RIP] != (greg_t) accessor.start)
+                continue;
+
+            u32 address = regs[REG_RSI];
+
+            if (accessor.write)
+                active->write_handler(active->ctx, address, regs[REG_RDX], accessor.size);
+            else
+                regs[REG_RAX] = active->read_handler(active->ctx, address, accessor.size);
+
+            regs[REG_RIP] = (greg_t) accessor.resume;
+            return;
+        }
+    }
+
+    // a genuine crash, restore the previous handler and let the instruction fault again
+    sigaction(SIGSEGV, &old_action, nullptr);
+}
+#endif
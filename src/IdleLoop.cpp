@@ -0,0 +1,577 @@
+/* discovery
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ *
+ * FILE: IdleLoop.cpp
+ * DATE: October 16th, 2026
+ * DESCRIPTION: detection of busy-wait loops that only poll memory for an interrupt
+ *
+ * A loop is idle when nothing it computes survives from one iteration to the next:
+ * no register or flag it writes is read before being written again, and it never stores.
+ * Such a loop only ever re-reads the same memory, which can only change when the scheduler
+ * fires an event or an interrupt is handled, so the cpu may as well skip straight to that point.
+ * That doesn't hold for every address, the timer counters for one count up between events,
+ * so the addresses the loop loads from are checked each time it is about to be skipped.
+ */
+#include <bit>
+
+#include "IdleLoop.h"
+#include "Memory.h"
+#include "util.h"
+
+// cpsr flags, tracked alongside r0 - r15
+constexpr u32 FLAG_N    = 1 << 16;
+constexpr u32 FLAG_Z    = 1 << 17;
+constexpr u32 FLAG_C    = 1 << 18;
+constexpr u32 FLAG_V    = 1 << 19;
+constexpr u32 FLAG_NZ   = FLAG_N | FLAG_Z;
+constexpr u32 FLAG_NZCV = FLAG_N | FLAG_Z | FLAG_C | FLAG_V;
+
+// flags read by a condition code
+static u32 conditionFlags(u32 condition)
+{
+    switch (condition)
+    {
+        case 0x0: case 0x1: return FLAG_Z;                   // EQ, NE
+        case 0x2: case 0x3: return FLAG_C;                   // CS, CC
+        case 0x4: case 0x5: return FLAG_N;                   // MI, PL
+        case 0x6: case 0x7: return FLAG_V;                   // VS, VC
+        case 0x8: case 0x9: return FLAG_C | FLAG_Z;          // HI, LS
+        case 0xA: case 0xB: return FLAG_N | FLAG_V;          // GE, LT
+        case 0xC: case 0xD: return FLAG_N | FLAG_Z | FLAG_V; // GT, LE
+        default:            return 0;                        // AL
+    }
+}
+
+IdleLoopDetector::IdleLoopDetector()
+{
+    override_address = IDLE_LOOP_AUTO;
+}
+
+void IdleLoopDetector::setOverride(u32 address)
+{
+    override_address = address;
+    loops.clear();
+}
+
+bool IdleLoopDetector::isIdle(Memory *mem, u32 branch, u32 target, State state, u32 const *regs)
+{
+    if (override_address == IDLE_LOOP_NONE)
+        return false;
+
+    // the game's idle loop is known, don't guess at any others
+    if (override_address != IDLE_LOOP_AUTO)
+        return branch == override_address;
+
+    u32 k = key(branch, state);
+    auto iter = loops.find(k);
+
+    if (iter == loops.end() || iter->second.target != target || (iter->second.idle && !unchanged(mem, iter->second, branch, state)))
+        iter = loops.insert_or_assign(k, analyze(mem, branch, target, state)).first;
+
+    Loop const &loop = iter->second;
+
+    if (!loop.idle)
+        return false;
+
+    // the registers a load is addressed from are never written by the loop, so they are the same on every iteration
+    for (int i = 0; i < loop.num_loads; ++i)
+    {
+        Load const &load = loop.loads[i];
+        u32 address = load.offset;
+
+        if (load.base >= 0)
+            address += regs[load.base];
+        if (load.index >= 0)
+            address += regs[load.index];
+
+        if (!pollable(address, load.size))
+            return false;
+    }
+
+    return true;
+}
+
+// memory that only changes when an event fires or an interrupt is handled
+// io registers besides these, like the timer counters, change on their own
+bool IdleLoopDetector::pollable(u32 address, int size)
+{
+    address &= ~(size - 1);
+
+    switch (address >> 24)
+    {
+        case 0x0: case 0x2: case 0x3:
+        case 0x5: case 0x6: case 0x7:
+        case 0x8: case 0x9:
+        case 0xA: case 0xB:
+        case 0xC: case 0xD:
+            return true;
+
+        case 0x4:
+            for (int i = 0; i < size; i += 2)
+            {
+                u32 reg = (address + i) & ~1;
+
+                if (reg != REG_DISPSTAT && reg != REG_VCOUNT && reg != REG_KEYINPUT && reg != REG_IE && reg != REG_IF)
+                    return false;
+            }
+
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+IdleLoopDetector::Loop IdleLoopDetector::analyze(Memory *mem, u32 branch, u32 target, State state)
+{
+    Loop loop;
+    loop.target    = target;
+    loop.idle      = false;
+    loop.num_loads = 0;
+
+    u32 width = state == State::ARM ? 4 : 2;
+    u32 len   = (branch - target) / width + 1;
+
+    if (len > MAX_LOOP_LEN)
+        return loop;
+
+    // registers read before the loop writes them, and registers the loop writes
+    u32 live_in = 0;
+    u32 written = 0;
+
+    // registers the loop has set to a constant so far, and their values
+    u32 known = 0;
+    u32 value[16];
+
+    for (u32 i = 0; i < len; ++i)
+    {
+        u32 address = target + i * width;
+        u32 opcode  = state == State::ARM ? mem->read32(address) : mem->read16(address);
+        Access access = { 0, 0, false, { -1, -1, 0, 0 }, -1, 0 };
+
+        loop.code[i] = opcode;
+
+        // the branch closing the loop only reads the flags its condition needs
+        if (address == branch)
+        {
+            if (state == State::ARM)
+                access.reads = conditionFlags(opcode >> 28);
+            else if (opcode >> 12 == 0xD)
+                access.reads = conditionFlags(opcode >> 8 & 0xF);
+        }
+
+        else if (state == State::ARM ? !accessArm(opcode, access) : !accessThumb(opcode, access))
+            return loop;
+
+        Load &load = access.from;
+
+        if (access.load)
+        {
+            // the pc reads two instructions ahead, word aligned for thumb literals
+            u32 pc = state == State::ARM ? address + 8 : (address + 4) & ~3;
+
+            // fold the pc and constants into the offset, anything else the loop writes makes the address unknown
+            auto fold = [&](int &reg)
+            {
+                if (reg == r15)
+                    load.offset += pc;
+                else if (reg >= 0 && (known >> reg & 1))
+                    load.offset += value[reg];
+                else
+                    return reg < 0 || !(written >> reg & 1);
+
+                reg = -1;
+                return true;
+            };
+
+            if (!fold(load.base) || !fold(load.index))
+                return loop;
+
+            loop.loads[loop.num_loads++] = load;
+        }
+
+        live_in |= access.reads & ~written;
+        written |= access.writes;
+        known   &= ~access.writes;
+
+        if (access.constant_reg >= 0)
+        {
+            known |= 1 << access.constant_reg;
+            value[access.constant_reg] = access.constant;
+        }
+
+        // a literal from the BIOS or ROM never changes, a load writes only its destination
+        else if (access.load && load.base < 0 && load.index < 0 && load.size == 4 && (load.offset >> 24 == 0x0 || load.offset >> 24 >= 0x8) && load.offset >> 24 <= 0xD)
+        {
+            int rd = std::countr_zero(access.writes);
+
+            known |= 1 << rd;
+            value[rd] = mem->read32(load.offset);
+        }
+    }
+
+    loop.idle = (live_in & written) == 0;
+    return loop;
+}
+
+// code in RAM may have been overwritten since the loop was analyzed
+bool IdleLoopDetector::unchanged(Memory *mem, Loop const &loop, u32 branch, State state)
+{
+    u32 region = branch >> 24;
+
+    if (region != 0x2 && region != 0x3)
+        return true;
+
+    u32 width = state == State::ARM ? 4 : 2;
+    u32 len   = (branch - loop.target) / width + 1;
+
+    for (u32 i = 0; i < len; ++i)
+    {
+        u32 address = loop.target + i * width;
+        u32 opcode  = state == State::ARM ? mem->read32(address) : mem->read16(address);
+
+        if (opcode != loop.code[i])
+            return false;
+    }
+
+    return true;
+}
+
+// only data processing and loads without writeback are allowed in an idle loop
+bool IdleLoopDetector::accessArm(u32 instruction, Access &access)
+{
+    u32 condition = util::bitseq<31, 28>(instruction);
+    u32 rn = util::bitseq<19, 16>(instruction);
+    u32 rd = util::bitseq<15, 12>(instruction);
+    u32 rm = util::bitseq<3, 0>(instruction);
+
+    bool pre_index = util::bitseq<24, 24>(instruction);
+    bool add       = util::bitseq<23, 23>(instruction);
+    bool writeback = util::bitseq<21, 21>(instruction);
+    bool load      = util::bitseq<20, 20>(instruction);
+
+    if (condition == 0xF)
+        return false;
+
+    switch (util::bitseq<27, 25>(instruction))
+    {
+        case 0b000:
+            // branch and exchange
+            if ((instruction & 0x0FFFFFF0) == 0x012FFF10)
+                return false;
+
+            if ((instruction & 0x90) == 0x90)
+            {
+                // multiply and swap
+                if (util::bitseq<6, 5>(instruction) == 0)
+                    return false;
+
+                // halfword transfer
+                if (!load || !pre_index || writeback)
+                    return false;
+
+                bool immediate = util::bitseq<22, 22>(instruction);
+                u32 offset     = util::bitseq<11, 8>(instruction) << 4 | util::bitseq<3, 0>(instruction);
+
+                // a subtracted register can't be folded into the address
+                if (!immediate && !add)
+                    return false;
+
+                access.reads  = 1 << rn | (immediate ? 0 : 1 << rm);
+                access.writes = 1 << rd;
+                access.load   = true;
+                access.from   = { (int) rn, immediate ? -1 : (int) rm, immediate ? (add ? offset : -offset) : 0, util::bitseq<6, 5>(instruction) == 0b10 ? 1 : 2 };
+                break;
+            }
+
+            [[fallthrough]];
+
+        case 0b001:
+        {
+            u32 opcode = util::bitseq<24, 21>(instruction);
+            bool s     = util::bitseq<20, 20>(instruction);
+            bool test  = opcode >= 0x8 && opcode <= 0xB; // TST, TEQ, CMP, CMN
+
+            // psr transfers are encoded as tests that don't set flags
+            if (test && !s)
+                return false;
+
+            // whether a logical op sets the carry from the shifter
+            bool shifter_carry = true;
+
+            if (util::bitseq<25, 25>(instruction))
+            {
+                // unrotated immediate leaves the carry alone
+                if (util::bitseq<11, 8>(instruction) == 0)
+                    shifter_carry = false;
+            }
+
+            else
+            {
+                access.reads |= 1 << rm;
+
+                // shift by register, a shift of 0 passes the old carry through
+                if (util::bitseq<4, 4>(instruction))
+                    access.reads |= 1 << util::bitseq<11, 8>(instruction) | (s ? FLAG_C : 0);
+
+                else if (util::bitseq<11, 7>(instruction) == 0)
+                {
+                    u32 shift_type = util::bitseq<6, 5>(instruction);
+
+                    if (shift_type == 0b00) // LSL #0
+                        shifter_carry = false;
+                    if (shift_type == 0b11) // RRX
+                        access.reads |= FLAG_C;
+                }
+            }
+
+            // MOV and MVN have no first operand
+            if (opcode != 0xD && opcode != 0xF)
+                access.reads |= 1 << rn;
+
+            // ADC, SBC, RSC
+            if (opcode >= 0x5 && opcode <= 0x7)
+                access.reads |= FLAG_C;
+
+            if (!test)
+                access.writes |= 1 << rd;
+
+            // MOV with an immediate, which loops use to set up an address
+            if (opcode == 0xD && util::bitseq<25, 25>(instruction) && condition == 0xE)
+            {
+                u32 imm    = util::bitseq<7, 0>(instruction);
+                u32 rotate = util::bitseq<11, 8>(instruction) * 2;
+
+                access.constant_reg = rd;
+                access.constant     = rotate ? imm >> rotate | imm << (32 - rotate) : imm;
+            }
+
+            if (s)
+            {
+                bool logical = opcode <= 0x1 || opcode == 0x8 || opcode == 0x9 || opcode >= 0xC;
+
+                if (logical)
+                    access.writes |= FLAG_NZ | (shifter_carry ? FLAG_C : 0);
+                else
+                    access.writes |= FLAG_NZCV;
+            }
+
+            break;
+        }
+
+        // single data transfer
+        case 0b010:
+        case 0b011:
+        {
+            if (!load || !pre_index || writeback)
+                return false;
+
+            bool reg_offset = util::bitseq<25, 25>(instruction);
+            u32 offset      = util::bitseq<11, 0>(instruction);
+
+            // a shifted or subtracted register can't be folded into the address
+            if (reg_offset && (!add || util::bitseq<11, 4>(instruction) != 0))
+                return false;
+
+            access.reads  = 1 << rn | (reg_offset ? 1 << rm : 0);
+            access.writes = 1 << rd;
+            access.load   = true;
+            access.from   = { (int) rn, reg_offset ? (int) rm : -1, reg_offset ? 0 : (add ? offset : -offset), util::bitseq<22, 22>(instruction) ? 1 : 4 };
+            break;
+        }
+
+        default:
+            return false;
+    }
+
+    // the loop can't jump anywhere but back to its start
+    if (access.writes & (1 << r15))
+        return false;
+
+    // the pc is the same on every iteration
+    access.reads &= ~(1 << r15);
+
+    // a skipped instruction leaves the old value of what it writes in place
+    if (condition != 0xE)
+        access.reads |= conditionFlags(condition) | access.writes;
+
+    return true;
+}
+
+bool IdleLoopDetector::accessThumb(u16 instruction, Access &access)
+{
+    u32 rd = util::bitseq<2, 0>(instruction);
+    u32 rs = util::bitseq<5, 3>(instruction);
+
+    // move shifted register / add subtract
+    if (instruction >> 13 == 0b000)
+    {
+        access.reads  = 1 << rs;
+        access.writes = 1 << rd;
+
+        if (util::bitseq<12, 11>(instruction) == 0b11)
+        {
+            if (!util::bitseq<10, 10>(instruction))
+                access.reads |= 1 << util::bitseq<8, 6>(instruction);
+
+            access.writes |= FLAG_NZCV;
+        }
+
+        else
+        {
+            // LSL #0 leaves the carry alone
+            bool carry = util::bitseq<12, 11>(instruction) != 0 || util::bitseq<10, 6>(instruction) != 0;
+            access.writes |= FLAG_NZ | (carry ? FLAG_C : 0);
+        }
+
+        return true;
+    }
+
+    // move / compare / add / subtract immediate
+    if (instruction >> 13 == 0b001)
+    {
+        u32 reg = util::bitseq<10, 8>(instruction);
+        access.constant = util::bitseq<7, 0>(instruction);
+
+        switch (util::bitseq<12, 11>(instruction))
+        {
+            case 0b00: access.writes = 1 << reg | FLAG_NZ; access.constant_reg = reg;   break; // MOV
+            case 0b01: access.reads  = 1 << reg; access.writes = FLAG_NZCV;             break; // CMP
+            default:   access.reads  = 1 << reg; access.writes = 1 << reg | FLAG_NZCV;  break; // ADD, SUB
+        }
+
+        return true;
+    }
+
+    // alu operations
+    if (instruction >> 10 == 0b010000)
+    {
+        switch (util::bitseq<9, 6>(instruction))
+        {
+            case 0x0: case 0x1: case 0xC: case 0xE: // AND, EOR, ORR, BIC
+                access.reads  = 1 << rd | 1 << rs;
+                access.writes = 1 << rd | FLAG_NZ;
+                break;
+
+            // a shift by 0 passes the old carry through
+            case 0x2: case 0x3: case 0x4: case 0x7: // LSL, LSR, ASR, ROR
+                access.reads  = 1 << rd | 1 << rs | FLAG_C;
+                access.writes = 1 << rd | FLAG_NZ | FLAG_C;
+                break;
+
+            case 0x5: case 0x6: // ADC, SBC
+                access.reads  = 1 << rd | 1 << rs | FLAG_C;
+                access.writes = 1 << rd | FLAG_NZCV;
+                break;
+
+            case 0x8: // TST
+                access.reads  = 1 << rd | 1 << rs;
+                access.writes = FLAG_NZ;
+                break;
+
+            case 0xA: case 0xB: // CMP, CMN
+                access.reads  = 1 << rd | 1 << rs;
+                access.writes = FLAG_NZCV;
+                break;
+
+            case 0x9: // NEG
+                access.reads  = 1 << rs;
+                access.writes = 1 << rd | FLAG_NZCV;
+                break;
+
+            case 0xD: // MUL destroys the carry
+                access.reads  = 1 << rd | 1 << rs;
+                access.writes = 1 << rd | FLAG_NZ | FLAG_C;
+                break;
+
+            case 0xF: // MVN
+                access.reads  = 1 << rs;
+                access.writes = 1 << rd | FLAG_NZ;
+                break;
+        }
+
+        return true;
+    }
+
+    // hi register operations
+    if (instruction >> 10 == 0b010001)
+    {
+        u32 hd = util::bitseq<7, 7>(instruction) << 3 | rd;
+        u32 hs = util::bitseq<6, 6>(instruction) << 3 | rs;
+
+        switch (util::bitseq<9, 8>(instruction))
+        {
+            case 0b00: access.reads = 1 << hd | 1 << hs; access.writes = 1 << hd;    break; // ADD
+            case 0b01: access.reads = 1 << hd | 1 << hs; access.writes = FLAG_NZCV;  break; // CMP
+            case 0b10: access.reads = 1 << hs;           access.writes = 1 << hd;    break; // MOV
+            default:   return false;                                                        // BX
+        }
+
+        if (access.writes & (1 << r15))
+            return false;
+
+        access.reads &= ~(1 << r15);
+        return true;
+    }
+
+    bool load = util::bitseq<11, 11>(instruction);
+
+    // pc relative load
+    if (instruction >> 11 == 0b01001)
+    {
+        access.writes = 1 << util::bitseq<10, 8>(instruction);
+        access.load   = true;
+        access.from   = { r15, -1, (u32) util::bitseq<7, 0>(instruction) * 4, 4 };
+        return true;
+    }
+
+    // load / store with register offset, and sign extended byte / halfword
+    if (instruction >> 12 == 0b0101)
+    {
+        // STR, STRB and STRH
+        if (util::bitseq<9, 9>(instruction) ? util::bitseq<11, 10>(instruction) == 0 : !load)
+            return false;
+
+        // LDRB and LDSB are bytes, LDRH and LDSH halfwords
+        int size = util::bitseq<9, 9>(instruction) ? (util::bitseq<11, 10>(instruction) == 0b10 ? 1 : 2) : (util::bitseq<10, 10>(instruction) ? 1 : 4);
+
+        access.reads  = 1 << rs | 1 << util::bitseq<8, 6>(instruction);
+        access.writes = 1 << rd;
+        access.load   = true;
+        access.from   = { (int) rs, (int) util::bitseq<8, 6>(instruction), 0, size };
+        return true;
+    }
+
+    // load / store with immediate offset, and halfword
+    if (instruction >> 13 == 0b011 || instruction >> 12 == 0b1000)
+    {
+        if (!load)
+            return false;
+
+        // LDRH, LDRB and LDR scale the offset by their size
+        u32 offset = util::bitseq<10, 6>(instruction);
+        int size   = instruction >> 12 == 0b1000 ? 2 : util::bitseq<12, 12>(instruction) ? 1 : 4;
+
+        access.reads  = 1 << rs;
+        access.writes = 1 << rd;
+        access.load   = true;
+        access.from   = { (int) rs, -1, offset * size, size };
+        return true;
+    }
+
+    // sp relative load
+    if (instruction >> 12 == 0b1001)
+    {
+        if (!load)
+            return false;
+
+        access.reads  = 1 << r13;
+        access.writes = 1 << util::bitseq<10, 8>(instruction);
+        access.load   = true;
+        access.from   = { r13, -1, (u32) util::bitseq<7, 0>(instruction) * 4, 4 };
+        return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,500 @@
+/* discovery
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ *
+ * FILE: Jit.cpp
+ * DATE: October 16th, 2026
+ * DESCRIPTION: x86-64 recompiler for blocks of guest code
+ *
+ * Each block becomes one native function. Simple data processing instructions on r0-r14
+ * are emitted inline, everything else calls back into the interpreter through Arm7::jitStep.
+ * Guest registers stay in Arm7::registers, so the two can be freely mixed.
+ */
+#include <cstddef>
+
+#include "Jit.h"
+#include "Arm7.h"
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#include <sys/mman.h>
+#endif
+
+using Registers = decltype(Arm7::registers);
+
+// host registers
+// rbx holds &Arm7::registers, r12d the cycles elapsed, r13d the budget and r14 the cpu
+constexpr int EAX = 0;
+constexpr int ECX = 1;
+constexpr int EDX = 2;
+constexpr int EBX = 3;
+constexpr int ESI = 6;
+
+// x86 condition codes
+constexpr u8 CC_O  = 0x0;
+constexpr u8 CC_C  = 0x2;
+constexpr u8 CC_NC = 0x3;
+constexpr u8 CC_Z  = 0x4;
+constexpr u8 CC_S  = 0x8;
+constexpr u8 CC_GE = 0xD;
+
+Jit::Jit()
+{
+    buffer   = nullptr;
+    ptr      = nullptr;
+    capacity = 0;
+}
+
+Jit::~Jit()
+{
+    #if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+    if (buffer)
+        munmap(buffer, capacity);
+    #endif
+}
+
+void Jit::reset()
+{
+    ptr = buffer;
+}
+
+Jit::Code Jit::compile(Arm7 &cpu, Block const &block, State state)
+{
+    if constexpr (!supported)
+        return nullptr;
+
+    #if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+    // the code buffer is only mapped once the jit is actually used
+    if (!buffer)
+    {
+        void *mapped = mmap(nullptr, BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (mapped == MAP_FAILED)
+        {
+            log(LogLevel::Warning, "Could not map jit code buffer, falling back to the interpreter\n");
+            return nullptr;
+        }
+
+        buffer   = static_cast<u8 *>(mapped);
+        ptr      = buffer;
+        capacity = BUFFER_SIZE;
+    }
+    #endif
+
+    if (full())
+        return nullptr;
+
+    u8 *code = ptr;
+    exits.clear();
+    call_exits.clear();
+    step_exits.clear();
+
+    // prologue, keeps the stack 16 byte aligned for the calls to jitStep
+    emit8(0x53);                            // push rbx
+    emit8(0x41); emit8(0x54);               // push r12
+    emit8(0x41); emit8(0x55);               // push r13
+    emit8(0x41); emit8(0x56);               // push r14
+    emit8(0x48); emit8(0x83); emit8(0xEC); emit8(0x08); // sub rsp, 8
+
+    emit8(0x41); emit8(0x89); emit8(0xFD);  // mov r13d, edi
+    emit8(0x45); emit8(0x31); emit8(0xE4);  // xor r12d, r12d
+    emit8(0x48); emit8(0xBB); emit64(reinterpret_cast<u64>(&cpu.registers)); // mov rbx, imm64
+    emit8(0x49); emit8(0xBE); emit64(reinterpret_cast<u64>(&cpu));           // mov r14, imm64
+
+    for (auto const &op : block.ops)
+    {
+        AluOp alu;
+
+        // fetches from the BIOS have to update last_read_bios, which jitStep takes care of
+        bool bios = state == State::ARM && op.address + 8 < MEM_BIOS_END;
+        bool inlined = !bios && (state == State::ARM ? decodeArm(op.opcode, alu) : decodeThumb(op.opcode, alu));
+
+        if (inlined)
+            emitAlu(cpu, op, alu, state);
+        else
+            emitCall(op);
+
+        // ran off the end of the block
+        if (&op == &block.ops.back() && inlined)
+            exits.push_back({ jump(), &op });
+    }
+
+    // epilogue, return the cycles elapsed
+    u8 *exit = ptr;
+    emit8(0x44); emit8(0x89); emit8(0xE0);  // mov eax, r12d
+    emit8(0x48); emit8(0x83); emit8(0xC4); emit8(0x08); // add rsp, 8
+    emit8(0x41); emit8(0x5E);               // pop r14
+    emit8(0x41); emit8(0x5D);               // pop r13
+    emit8(0x41); emit8(0x5C);               // pop r12
+    emit8(0x5B);                            // pop rbx
+    emit8(0xC3);                            // ret
+
+    // jitStep asked to leave the block, its cycles are complemented in eax
+    u8 *step_exit = ptr;
+    emit8(0xF7); emit8(0xD0);               // not eax
+    emit8(0x41); emit8(0x01); emit8(0xC4);  // add r12d, eax
+    patch(jump(), exit);
+
+    // the interpreter doesn't see inline instructions, so they put themselves in pipeline[0] on the way out
+    for (auto [rel, op] : exits)
+    {
+        patch(rel, ptr);
+        emit8(0x48); emit8(0xB8); emit64(reinterpret_cast<u64>(&cpu.pipeline[0])); // mov rax, imm64
+        emit8(0xC7); emit8(0x00); emit32(op->opcode);             // mov dword [rax], imm32
+        emit8(0xC7); emit8(0x40); emit8(0x04); emit32(op->address); // mov dword [rax + 4], imm32
+        patch(jump(), exit);
+    }
+
+    for (u8 *rel : call_exits)
+        patch(rel, exit);
+
+    for (u8 *rel : step_exits)
+        patch(rel, step_exit);
+
+    return reinterpret_cast<Code>(code);
+}
+
+// inline an instruction, then leave the block if the budget ran out
+void Jit::emitAlu(Arm7 &cpu, MicroOp const &op, AluOp const &alu, State state)
+{
+    int const cpsr = offsetof(Registers, cpsr);
+
+    // eax = first operand, ecx = second operand
+    if (alu.op != AluOp::MOV && alu.op != AluOp::MVN)
+        load(EAX, alu.Rn * 4);
+
+    if (alu.Rm >= 0)
+        load(ECX, alu.Rm * 4);
+    else
+    {
+        emit8(0xB8 + ECX);                  // mov ecx, imm32
+        emit32(alu.immediate);
+    }
+
+    switch (alu.op)
+    {
+        case AluOp::AND: emit8(0x21); emit8(0xC8); break; // and eax, ecx
+        case AluOp::EOR: emit8(0x31); emit8(0xC8); break; // xor eax, ecx
+        case AluOp::SUB: emit8(0x29); emit8(0xC8); break; // sub eax, ecx
+        case AluOp::ADD: emit8(0x01); emit8(0xC8); break; // add eax, ecx
+        case AluOp::ORR: emit8(0x09); emit8(0xC8); break; // or eax, ecx
+        case AluOp::MOV: emit8(0x89); emit8(0xC8); break; // mov eax, ecx
+
+        case AluOp::RSB:
+            emit8(0x29); emit8(0xC1);       // sub ecx, eax
+            emit8(0x89); emit8(0xC8);       // mov eax, ecx
+            break;
+
+        case AluOp::BIC:
+            emit8(0xF7); emit8(0xD1);       // not ecx
+            emit8(0x21); emit8(0xC8);       // and eax, ecx
+            break;
+
+        case AluOp::MVN:
+            emit8(0x89); emit8(0xC8);       // mov eax, ecx
+            emit8(0xF7); emit8(0xD0);       // not eax
+            break;
+    }
+
+    if (alu.flags != AluOp::NONE)
+    {
+        u32 mask;
+
+        // edx = new C and V flags, straight from the host flags for arithmetic ops
+        if (alu.flags == AluOp::LOGICAL)
+        {
+            if (alu.carry < 0)
+            {
+                emit8(0x31); emit8(0xD2);   // xor edx, edx
+                mask = 0x3FFFFFFF;
+            }
+
+            else
+            {
+                emit8(0xB8 + EDX);          // mov edx, imm32
+                emit32(alu.carry << 29);
+                mask = 0x1FFFFFFF;
+            }
+        }
+
+        else
+        {
+            // ARM uses an inverted carry flag for borrow
+            emit8(0x0F); emit8(0x90 | (alu.flags == AluOp::ADDITION ? CC_C : CC_NC)); emit8(0xC2); // setc/setnc dl
+            emit8(0x0F); emit8(0x90 | CC_O); emit8(0xC1); // seto cl
+            emit8(0x0F); emit8(0xB6); emit8(0xD2);        // movzx edx, dl
+            emit8(0xC1); emit8(0xE2); emit8(29);          // shl edx, 29
+            emit8(0x0F); emit8(0xB6); emit8(0xC9);        // movzx ecx, cl
+            emit8(0xC1); emit8(0xE1); emit8(28);          // shl ecx, 28
+            emit8(0x09); emit8(0xCA);                     // or edx, ecx
+            mask = 0x0FFFFFFF;
+        }
+
+        // N and Z from the result
+        emit8(0x89); emit8(0xC6);                         // mov esi, eax
+        emit8(0x81); emit8(0xE6); emit32(0x80000000);     // and esi, 0x80000000
+        emit8(0x09); emit8(0xF2);                         // or edx, esi
+        emit8(0x85); emit8(0xC0);                         // test eax, eax
+        emit8(0x0F); emit8(0x90 | CC_Z); emit8(0xC1);     // sete cl
+        emit8(0x0F); emit8(0xB6); emit8(0xC9);            // movzx ecx, cl
+        emit8(0xC1); emit8(0xE1); emit8(30);              // shl ecx, 30
+        emit8(0x09); emit8(0xCA);                         // or edx, ecx
+
+        load(ESI, cpsr);
+        emit8(0x81); emit8(0xE6); emit32(mask);           // and esi, mask
+        emit8(0x09); emit8(0xD6);                         // or esi, edx
+        store(ESI, cpsr);
+    }
+
+    if (alu.Rd >= 0)
+        store(EAX, alu.Rd * 4);
+
+    emitCycles(cpu, op.address, state, alu.i);
+
+    // add dword [rbx + r15], 4 / 2
+    emit8(0x83); emit8(0x83); emit32(15 * 4); emit8(state == State::ARM ? 4 : 2);
+
+    emit8(0x45); emit8(0x39); emit8(0xEC);  // cmp r12d, r13d
+    exits.push_back({ jump(CC_GE), &op });
+}
+
+// run an instruction through the interpreter
+void Jit::emitCall(MicroOp const &op)
+{
+    emit8(0x4C); emit8(0x89); emit8(0xF7);  // mov rdi, r14
+    emit8(0x48); emit8(0xBE); emit64(reinterpret_cast<u64>(&op));          // mov rsi, imm64
+    emit8(0x44); emit8(0x89); emit8(0xE2);  // mov edx, r12d
+    emit8(0x48); emit8(0xB8); emit64(reinterpret_cast<u64>(&Arm7::jitStep)); // mov rax, imm64
+    emit8(0xFF); emit8(0xD0);               // call rax
+
+    emit8(0x85); emit8(0xC0);               // test eax, eax
+    step_exits.push_back(jump(CC_S));
+    emit8(0x41); emit8(0x01); emit8(0xC4);  // add r12d, eax
+    emit8(0x45); emit8(0x39); emit8(0xEC);  // cmp r12d, r13d
+    call_exits.push_back(jump(CC_GE));
+}
+
+// 1S + internal cycles, see Arm7::tick
+// the S cycle is loaded from the timing table as WAITCNT can change it after compiling
+void Jit::emitCycles(Arm7 &cpu, u32 address, State state, u8 i)
+{
+    u8 *s_cycles = &cpu.mem->access_cycles[address >> 24 & 0xF][state == State::ARM][1];
+
+    emit8(0x48); emit8(0xB8); emit64(reinterpret_cast<u64>(s_cycles)); // mov rax, imm64
+    emit8(0x0F); emit8(0xB6); emit8(0x00);  // movzx eax, byte [rax]
+    emit8(0x41); emit8(0x01); emit8(0xC4);  // add r12d, eax
+
+    if (i)
+    {
+        emit8(0x41); emit8(0x83); emit8(0xC4); emit8(i); // add r12d, imm8
+    }
+}
+
+/*
+ * Unconditional data processing with an immediate or unshifted register operand.
+ * r15 reads ahead of the instruction and writing it branches, so it's left to the interpreter along with the carrying ops.
+ */
+bool Jit::decodeArm(u32 instruction, AluOp &alu)
+{
+    if (util::bitseq<31, 28>(instruction) != 0xE || util::bitseq<27, 26>(instruction) != 0)
+        return false;
+
+    bool immediate = util::bitseq<25, 25>(instruction) == 0x1;
+    bool set_condition_code = util::bitseq<20, 20>(instruction) == 0x1;
+    u8 opcode = util::bitseq<24, 21>(instruction);
+
+    // a shifted register operand could be a multiply, swap, halfword transfer or bx as well
+    if (!immediate && util::bitseq<11, 4>(instruction) != 0)
+        return false;
+
+    // TST, TEQ, CMP and CMN without S are psr transfers
+    if (opcode >= 0b1000 && opcode <= 0b1011 && !set_condition_code)
+        return false;
+
+    alu.Rd = util::bitseq<15, 12>(instruction);
+    alu.Rn = util::bitseq<19, 16>(instruction);
+    alu.Rm = immediate ? -1 : instruction & 0xF;
+    alu.i  = immediate ? 0 : 1; // + 1I cycles with register shift, see Arm7::dataProcessing
+    alu.carry = -1;
+
+    if (immediate)
+    {
+        u32 imm    = util::bitseq<7, 0>(instruction);
+        u32 rotate = util::bitseq<11, 8>(instruction) * 2;
+
+        alu.immediate = rotate ? (imm >> rotate) | (imm << (32 - rotate)) : imm;
+
+        if (rotate)
+            alu.carry = alu.immediate >> 31;
+    }
+
+    switch (opcode)
+    {
+        case 0b0000: alu.op = AluOp::AND; alu.flags = AluOp::LOGICAL;     break;
+        case 0b0001: alu.op = AluOp::EOR; alu.flags = AluOp::LOGICAL;     break;
+        case 0b0010: alu.op = AluOp::SUB; alu.flags = AluOp::SUBTRACTION; break;
+        case 0b0011: alu.op = AluOp::RSB; alu.flags = AluOp::SUBTRACTION; break;
+        case 0b0100: alu.op = AluOp::ADD; alu.flags = AluOp::ADDITION;    break;
+        case 0b1000: alu.op = AluOp::AND; alu.flags = AluOp::LOGICAL;     break; // TST
+        case 0b1001: alu.op = AluOp::EOR; alu.flags = AluOp::LOGICAL;     break; // TEQ
+        case 0b1010: alu.op = AluOp::SUB; alu.flags = AluOp::SUBTRACTION; break; // CMP
+        case 0b1011: alu.op = AluOp::ADD; alu.flags = AluOp::ADDITION;    break; // CMN
+        case 0b1100: alu.op = AluOp::ORR; alu.flags = AluOp::LOGICAL;     break;
+        case 0b1101: alu.op = AluOp::MOV; alu.flags = AluOp::LOGICAL;     break;
+        case 0b1110: alu.op = AluOp::BIC; alu.flags = AluOp::LOGICAL;     break;
+        case 0b1111: alu.op = AluOp::MVN; alu.flags = AluOp::LOGICAL;     break;
+        default: return false; // ADC, SBC, RSC
+    }
+
+    // Rd also costs extra cycles for the test ops when it is r15, so it's checked for them too
+    if (alu.Rd == r15 || alu.Rm == r15 || (alu.op != AluOp::MOV && alu.op != AluOp::MVN && alu.Rn == r15))
+        return false;
+
+    if (opcode >= 0b1000 && opcode <= 0b1011)
+        alu.Rd = -1;
+
+    if (!set_condition_code)
+        alu.flags = AluOp::NONE;
+
+    return true;
+}
+
+// thumb move / compare / add / subtract immediate, add / subtract, LSL #0 and the simple ALU ops
+bool Jit::decodeThumb(u16 instruction, AluOp &alu)
+{
+    alu.i     = 0;
+    alu.carry = -1;
+    alu.Rm    = -1;
+
+    // move shifted register, LSL #0 is a flag setting move
+    if ((instruction & 0xFFC0) == 0x0000)
+    {
+        alu.op    = AluOp::MOV;
+        alu.flags = AluOp::LOGICAL;
+        alu.Rd    = util::bitseq<2, 0>(instruction);
+        alu.Rm    = util::bitseq<5, 3>(instruction);
+        return true;
+    }
+
+    // add / subtract
+    if ((instruction & 0xF800) == 0x1800)
+    {
+        bool subtract = util::bitseq<9, 9>(instruction) == 0x1;
+
+        alu.op    = subtract ? AluOp::SUB : AluOp::ADD;
+        alu.flags = subtract ? AluOp::SUBTRACTION : AluOp::ADDITION;
+        alu.Rd    = util::bitseq<2, 0>(instruction);
+        alu.Rn    = util::bitseq<5, 3>(instruction);
+
+        if (util::bitseq<10, 10>(instruction))
+            alu.immediate = util::bitseq<8, 6>(instruction);
+        else
+            alu.Rm = util::bitseq<8, 6>(instruction);
+
+        return true;
+    }
+
+    // move / compare / add / subtract immediate
+    if ((instruction & 0xE000) == 0x2000)
+    {
+        alu.Rd = alu.Rn = util::bitseq<10, 8>(instruction);
+        alu.immediate = util::bitseq<7, 0>(instruction);
+
+        switch (util::bitseq<12, 11>(instruction))
+        {
+            case 0: alu.op = AluOp::MOV; alu.flags = AluOp::LOGICAL;                 break;
+            case 1: alu.op = AluOp::SUB; alu.flags = AluOp::SUBTRACTION; alu.Rd = -1; break; // CMP
+            case 2: alu.op = AluOp::ADD; alu.flags = AluOp::ADDITION;                break;
+            case 3: alu.op = AluOp::SUB; alu.flags = AluOp::SUBTRACTION;             break;
+        }
+
+        return true;
+    }
+
+    // ALU operations, Rd is both the destination and the first operand
+    if ((instruction & 0xFC00) == 0x4000)
+    {
+        int Rs = util::bitseq<5, 3>(instruction);
+        int Rd = util::bitseq<2, 0>(instruction);
+
+        alu.Rd = alu.Rn = Rd;
+        alu.Rm = Rs;
+
+        switch (util::bitseq<9, 6>(instruction))
+        {
+            case 0b0000: alu.op = AluOp::AND; alu.flags = AluOp::LOGICAL;                 break;
+            case 0b0001: alu.op = AluOp::EOR; alu.flags = AluOp::LOGICAL;                 break;
+            case 0b1000: alu.op = AluOp::AND; alu.flags = AluOp::LOGICAL;     alu.Rd = -1; break; // TST
+            case 0b1010: alu.op = AluOp::SUB; alu.flags = AluOp::SUBTRACTION; alu.Rd = -1; break; // CMP
+            case 0b1011: alu.op = AluOp::ADD; alu.flags = AluOp::ADDITION;    alu.Rd = -1; break; // CMN
+            case 0b1100: alu.op = AluOp::ORR; alu.flags = AluOp::LOGICAL;                 break;
+            case 0b1110: alu.op = AluOp::BIC; alu.flags = AluOp::LOGICAL;                 break;
+            case 0b1111: alu.op = AluOp::MVN; alu.flags = AluOp::LOGICAL;                 break;
+
+            // NEG is 0 - Rs
+            case 0b1001:
+                alu.op = AluOp::RSB;
+                alu.flags = AluOp::SUBTRACTION;
+                alu.Rn = Rs;
+                alu.Rm = -1;
+                alu.immediate = 0;
+                break;
+
+            default: return false; // shifts, ADC, SBC, ROR and MUL
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+void Jit::emit32(u32 value)
+{
+    std::memcpy(ptr, &value, sizeof(value));
+    ptr += sizeof(value);
+}
+
+void Jit::emit64(u64 value)
+{
+    std::memcpy(ptr, &value, sizeof(value));
+    ptr += sizeof(value);
+}
+
+// mov reg, [rbx + offset]
+void Jit::load(int reg, int offset)
+{
+    emit8(0x8B);
+    emit8(0x80 | reg << 3 | EBX);
+    emit32(offset);
+}
+
+// mov [rbx + offset], reg
+void Jit::store(int reg, int offset)
+{
+    emit8(0x89);
+    emit8(0x80 | reg << 3 | EBX);
+    emit32(offset);
+}
+
+// jmp rel32, returns the address of rel32
+u8 *Jit::jump()
+{
+    emit8(0xE9);
+    emit32(0);
+    return ptr - 4;
+}
+
+// jcc rel32, returns the address of rel32
+u8 *Jit::jump(u8 condition)
+{
+    emit8(0x0F);
+    emit8(0x80 | condition);
+    emit32(0);
+    return ptr - 4;
+}
+
+void Jit::patch(u8 *rel, u8 *target)
+{
+    u32 offset = static_cast<u32>(target - (rel + 4));
+    std::memcpy(rel, &offset, sizeof(offset));
+}
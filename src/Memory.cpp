@@ -8,6 +8,7 @@
  * DESCRIPTION: Implementation of memory related functions
  */
 #include "Memory.h"
+#include "BlockCache.h"
 #include "IRQ.h"
 #include "Flash.h"
 #include "None.h"
@@ -15,25 +16,38 @@
 #include "config.h"
 #include "util.h"
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <regex>
 #include <experimental/filesystem>
 #include <string.h>
+#include <string_view>
 #include <cassert>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 extern IRQ *irq;
 
 namespace fs = std::experimental::filesystem;
 
-Memory::Memory(LcdStat *stat, Timer *timer, Gamepad *gamepad) :
+Memory::Memory(LcdStat *stat, Timer *timer, Gamepad *gamepad, Scheduler *scheduler) :
     stat(stat),
     timer(timer),
-    gamepad(gamepad)
+    gamepad(gamepad),
+    scheduler(scheduler)
 {
     backup = nullptr;
+    cart_rom = nullptr;
     cart_ram = nullptr;
+    block_cache = nullptr;
 
+    rom_size = 0;
+    rom_capacity = 0;
+
+    mapIo();
     reset();
 }
 
@@ -41,23 +55,26 @@ Memory::~Memory()
 {
     // dump cart ram contents to backup file
     backup->writeChip();    
+
+    if (cart_rom)
+        munmap(cart_rom, rom_capacity);
 }
 
 void Memory::reset()
 {
-    // default cycle accesses for waitstates
-    n_cycles = 4;
-    s_cycles = 2;
-
-    rom_size = 0;
     ram_size = 0;
 
-    // zero memory
-    for (int i = 0; i < MEM_SIZE; ++i)
-        memory[i] = 0;
+    // zero memory, the cart is left as it is
+    memset(bios,   0, sizeof(bios));
+    memset(ewram,  0, sizeof(ewram));
+    memset(iwram,  0, sizeof(iwram));
+    memset(io,     0, sizeof(io));
+    memset(palram, 0, sizeof(palram));
+    memset(vram,   0, sizeof(vram));
+    memset(oam,    0, sizeof(oam));
 
-    for (int i = 0; i < 0x2000000; ++i)
-        cart_rom[i] = 0;
+    // every tile has changed as far as the tile cache knows
+    memset(vram_dirty, 0xFF, sizeof(vram_dirty));
 
     // zero dma
     for (int i = 0; i < 4; ++i)
@@ -73,65 +90,217 @@ void Memory::reset()
 
         dma[i].src_address      = 0;
         dma[i].dest_address     = 0;
+
+        dma_armed[i]            = 0;
+        scheduler->remove(dma_event[i]);
+    }
+
+    dma_starting = 0;
+    dma_cycles   = 0;
+
+    halt_state = HaltState::RUNNING;
+
+    mapPages();
+    updateWaitstates();
+}
+
+// point every page of plain memory at its backing buffer, following the region's mirroring
+// MMIO, palette RAM and OAM (smaller than a page, with side effects) and cart RAM are left to the slow path
+void Memory::mapPages()
+{
+    for (int i = 0; i < NUM_PAGES; ++i)
+    {
+        u32 address = i << PAGE_SHIFT;
+
+        read_table[i]  = nullptr;
+        write_table[i] = nullptr;
+
+        switch (address >> 24)
+        {
+            // BIOS, writes are dropped by the slow path
+            case 0x0:
+                if (address <= MEM_BIOS_END)
+                    read_table[i] = &bios[address];
+                break;
+
+            // EWRAM
+            case 0x2:
+                read_table[i] = write_table[i] = &ewram[address & (MEM_EWRAM_SIZE - 1)];
+                break;
+
+            // IWRAM
+            case 0x3:
+                read_table[i] = write_table[i] = &iwram[address & (MEM_IWRAM_SIZE - 1)];
+                break;
+
+            // VRAM, mirrored every 128 KB with 0x6018000 - 0x601FFFF mirroring 0x6010000 - 0x6017FFF
+            case 0x6:
+                read_table[i] = write_table[i] = &vram[vramOffset(address)];
+                break;
+
+            // ROM images 0 - 2, past the end of the ROM is open bus
+            case 0x8: case 0x9:
+            case 0xA: case 0xB:
+            case 0xC: case 0xD:
+                if ((address & (MEM_ROM_MAX_SIZE - 1)) < rom_capacity)
+                    read_table[i] = &cart_rom[address & (MEM_ROM_MAX_SIZE - 1)];
+                break;
+        }
+    }
+}
+
+// library id strings games embed in the ROM, naming their cart RAM type
+enum BackupId
+{
+    ID_EEPROM,
+    ID_FLASH1M,
+    ID_FLASH512,
+    ID_FLASH,
+    ID_SRAM,
+    NUM_BACKUP_IDS,
+};
+
+static std::string_view const backup_ids[NUM_BACKUP_IDS] =
+{
+    "EEPROM_V",
+    "FLASH1M_V",
+    "FLASH512_V",
+    "FLASH_V",
+    "SRAM",
+};
+
+// finds every id in one pass over the ROM, returns a bit for each one found
+// ids only start with E, F or S, so most bytes are rejected by a single compare
+static u32 scanBackupIds(u8 const *rom, size_t size)
+{
+    std::string_view text((char const *) rom, size);
+    u32 found = 0;
+
+    for (size_t i = 0; i < size; ++i)
+    {
+        char c = text[i];
+        if (c != 'E' && c != 'F' && c != 'S')
+            continue;
+
+        std::string_view rest = text.substr(i);
+
+        for (int id = 0; id < NUM_BACKUP_IDS; ++id)
+        {
+            if (backup_ids[id][0] == c && rest.substr(0, backup_ids[id].size()) == backup_ids[id])
+                found |= 1 << id;
+        }
     }
 
-    haltcnt = 0;
+    return found;
+}
+
+u8 *Memory::backing(u32 address)
+{
+    switch (address >> 24)
+    {
+        case 0x0: return address <= MEM_BIOS_END ? &bios[address] : nullptr;
+        case 0x2: return &ewram[address & (MEM_EWRAM_SIZE - 1)];
+        case 0x3: return &iwram[address & (MEM_IWRAM_SIZE - 1)];
+        case 0x4: return address <= MEM_IO_REG_END + 1 ? &io[address & (MEM_IO_REG_SIZE - 1)] : nullptr;
+        case 0x5: return &palram[address & (MEM_PALETTE_RAM_SIZE - 1)];
+        case 0x7: return &oam[address & (MEM_OAM_SIZE - 1)];
+
+        case 0x6: return &vram[vramOffset(address)];
+
+        case 0x8: case 0x9:
+        case 0xA: case 0xB:
+        case 0xC: case 0xD:
+        {
+            u32 offset = address & (MEM_ROM_MAX_SIZE - 1);
+            return offset < rom_capacity ? &cart_rom[offset] : nullptr;
+        }
+
+        default:
+            return nullptr;
+    }
 }
 
 bool Memory::loadRom(std::string const &name)
 {
-    std::ifstream rom(name, std::ios::in | std::ios::binary);
+    int fd = open(name.c_str(), O_RDONLY);
+    struct stat info;
 
-    if (!rom || !rom.good())
+    if (fd < 0 || fstat(fd, &info) != 0 || info.st_size == 0)
     {
         log(LogLevel::Error, "Error: Unable to open ROM file {}\n", name);
         exit(1);
     }
 
-    rom_size = fs::file_size(name);
+    rom_size = info.st_size;
+
+    if (rom_size > MEM_ROM_MAX_SIZE)
+    {
+        log(LogLevel::Warning, "ROM file {} is larger than 32 MB, ignoring the rest\n", name);
+        rom_size = MEM_ROM_MAX_SIZE;
+    }
+
+    if (cart_rom)
+        munmap(cart_rom, rom_capacity);
+
+    // whole pages, so the page tables never point past the buffer
+    rom_capacity = (rom_size + PAGE_MASK) & ~PAGE_MASK;
+
+    // reserve the pages, then map the file over the start of them so nothing is copied
+    void *rom = mmap(nullptr, rom_capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (rom == MAP_FAILED || mmap(rom, rom_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+        log(LogLevel::Error, "Error: Unable to map ROM file {}\n", name);
+        exit(1);
+    }
+
+    close(fd);
+    cart_rom = static_cast<u8 *>(rom);
+
+    // the rest of the last page reads as open bus, the halfword address
+    for (size_t i = rom_size; i < rom_capacity; ++i)
+        cart_rom[i] = (i >> 1) >> (8 * (i & 1)) & 0xFF;
+
+    // the ROM never changes from here on
+    mprotect(cart_rom, rom_capacity, PROT_READ);
 
-    rom.read((char *) cart_rom, rom_size);
-    rom.close();
+    mapPages();
 
     // get cart RAM type
-    std::string rom_temp((char *) cart_rom, rom_size);
+    // a ROM naming more than one type gets the one latest in backup_ids
+    u32 ids = scanBackupIds(cart_rom, rom_size);
 
-    // eeprom
-    if (rom_temp.find("EEPROM_V") != std::string::npos)
+    if (ids & 1 << ID_EEPROM)
     {
         log(LogLevel::Warning, "Cart RAM EEPROM detected\n");
     }
 
-    // flash 1M
-    if (rom_temp.find("FLASH1M_V") != std::string::npos)
+    if (ids & 1 << ID_SRAM)
     {
-        log(LogLevel::Warning, "Cart RAM FLASH128 detected\n");
-        ram_size = 0x20000;
-        backup   = new Flash(ram_size); 
+        log(LogLevel::Warning, "Cart RAM SRAM detected\n");
+        ram_size    = 0x10000;
+        backup = new SRAM(0x10000);
     }
 
-    // flash 512
-    if (rom_temp.find("FLASH512_V") != std::string::npos)
+    else if (ids & 1 << ID_FLASH)
     {
-        log(LogLevel::Warning, "Cart RAM FLASH512 detected\n");
+        log(LogLevel::Warning, "Cart RAM FLASH detected\n");
         ram_size = 0x10000;
         backup   = new Flash(ram_size); 
     }
 
-    // flashv
-    if (rom_temp.find("FLASH_V") != std::string::npos)
+    else if (ids & 1 << ID_FLASH512)
     {
-        log(LogLevel::Warning, "Cart RAM FLASH detected\n");
+        log(LogLevel::Warning, "Cart RAM FLASH512 detected\n");
         ram_size = 0x10000;
         backup   = new Flash(ram_size); 
     }
 
-    // sram
-    if (rom_temp.find("SRAM") != std::string::npos)
+    else if (ids & 1 << ID_FLASH1M)
     {
-        log(LogLevel::Warning, "Cart RAM SRAM detected\n");
-        ram_size    = 0x10000;
-        backup = new SRAM(0x10000);
+        log(LogLevel::Warning, "Cart RAM FLASH128 detected\n");
+        ram_size = 0x20000;
+        backup   = new Flash(ram_size); 
     }
 
     // no cart RAM detected
@@ -172,36 +341,26 @@ bool Memory::loadBios(std::string const &name)
         exit(1);
     }
 
-    bios.read((char *) memory, MEM_BIOS_SIZE);
+    bios.read((char *) this->bios, MEM_BIOS_SIZE);
     bios.close();
     return true;
 }
 
-u32 Memory::read32(u32 address)
-{
-    return (read8(address + 3) << 24)
-    | (read8(address + 2) << 16)
-    | (read8(address + 1) << 8)
-    | read8(address);
-}
-
-u16 Memory::read16(u32 address)
-{
-    return (read8(address + 1) << 8) | read8(address);
-}
-
-u8 Memory::read8(u32 address)
+u8 Memory::read8Slow(u32 address)
 {
     // get memory region for mirrors
     switch (address >> 24)
     {
         case 0x0: [[fallthrough]];
         case 0x1: [[fallthrough]];
-        case 0x4: [[fallthrough]];
         case 0x8: [[fallthrough]];
         case 0x9:
             break;
 
+        // MMIO
+        case 0x4:
+            return readIo(address, 1);
+
         // EWRAM
         case 0x2:
             address &= MEM_EWRAM_END;
@@ -259,92 +418,49 @@ u8 Memory::read8(u32 address)
 
 
     // game rom
-    if (address >= MEM_SIZE)
+    if (address >= MEM_GAMEPAK_ROM_START)
     {
-        // if (address - MEM_SIZE > rom_size)
-        //std::cout << "Caution: reading outside known cart length\n";
+        if (u8 *ptr = backing(address))
+            return *ptr;
 
-        return cart_rom[address - MEM_SIZE];
+        // past the end of the ROM the bus still holds the halfword address
+        return (address >> 1) >> (8 * (address & 1)) & 0xFF;
     }
 
-    switch (address)
-    {
-        case REG_DISPSTAT:     return stat->dispstat.raw >> 0 & 0xFF;
-        case REG_DISPSTAT + 1: return stat->dispstat.raw >> 8 & 0xFF;
-
-        case REG_VCOUNT:       return stat->scanline;
-
-        // REG_TM0D
-        case REG_TM0D:         return timer->read(0) >> 0 & 0xFF;
-        case REG_TM0D + 1:     return timer->read(0) >> 8 & 0xFF;
-
-        // REG_TM1D
-        case REG_TM1D:         return timer->read(1) >> 0 & 0xFF;
-        case REG_TM1D + 1:     return timer->read(1) >> 8 & 0xFF;
-
-        // REG_TM2D
-        case REG_TM2D:         return timer->read(2) >> 0 & 0xFF;
-        case REG_TM2D + 1:     return timer->read(2) >> 8 & 0xFF;
-
-        // REG_TM3D
-        case REG_TM3D:         return timer->read(3) >> 0 & 0xFF;
-        case REG_TM3D + 1:     return timer->read(3) >> 8 & 0xFF;
-
-        // REG_KEYINPUT
-        case REG_KEYINPUT:     return gamepad->keys.raw >> 0 & 0xFF;
-        case REG_KEYINPUT + 1: return gamepad->keys.raw >> 8 & 0xFF;
-
-        // REG_IF
-        case REG_IF:           return irq->getIF() >> 0 & 0xFF;
-        case REG_IF + 1:       return irq->getIF() >> 8 & 0xFF;
-
-        // REG_IE
-        case REG_IE:           return irq->getIE() >> 0 & 0xFF;
-        case REG_IE + 1:       return irq->getIE() >> 8 & 0xFF;
-
-        // REG_IME
-        case REG_IME:          return irq->getIME() >> 0 & 0xFF;
-        case REG_IME + 1:      return irq->getIME() >> 8 & 0xFF;
-
-        default:
-            return memory[address];
-    }
+    u8 *ptr = backing(address);
+    return ptr ? *ptr : 0;
 }
 
-void Memory::write32(u32 address, u32 value)
-{
-    write8(address    , (value >>  0) & 0xFF);
-    write8(address + 1, (value >>  8) & 0xFF);
-    write8(address + 2, (value >> 16) & 0xFF);
-    write8(address + 3, (value >> 24) & 0xFF);
-}
-
-void Memory::write16(u32 address, u16 value)
-{
-    write8(address    , (value >> 0) & 0xFF);
-    write8(address + 1, (value >> 8) & 0xFF);
-}
-
-void Memory::write8(u32 address, u8 value)
+void Memory::write8Slow(u32 address, u8 value)
 {
 
     switch (address >> 24)
     {
         case 0x0:
         case 0x1:
-        case 0x4:
         case 0x8:
         case 0x9:
             break;
 
+        // MMIO
+        case 0x4:
+            writeIo(address, value, 1);
+            return;
+
         // EWRAM
         case 0x2:
             address &= MEM_EWRAM_END;
+
+            if (block_cache)
+                block_cache->invalidate(address);
             break;
 
         // IWRAM
         case 0x3:
             address &= MEM_IWRAM_END;
+
+            if (block_cache)
+                block_cache->invalidate(address);
             break;
 
         // Palette RAM
@@ -359,6 +475,7 @@ void Memory::write8(u32 address, u8 value)
                 address -= 0x8000;
 
             address &= 0x601FFFF;
+            invalidate(address);
             break;
 
         // OAM
@@ -406,419 +523,478 @@ void Memory::write8(u32 address, u8 value)
         return;
     }
 
-    //game rom
-    if (address >= MEM_SIZE)
-    {
-        //std::cerr << "Warning: writing to game rom\n";
-        cart_rom[address - MEM_SIZE] = value;
-        // std::cerr << "Done\n";
+    // game rom is mapped read only
+    if (address >= MEM_GAMEPAK_ROM_START)
         return;
-    }
 
     // write value at memory location
-    memory[address] = value;
+    if (u8 *ptr = backing(address))
+        *ptr = value;
+}
+
+// an access of size bytes to io registers, each register touched is handled once
+// bytes without a register, or with a register that has no read handler, read back what was written
+u32 Memory::readIo(u32 address, int size)
+{
+    u32 offset = address - MEM_IO_REG_START;
+    u32 value  = 0;
 
-    switch (address)
+    if (offset >= MEM_IO_REG_SIZE)
+        return 0;
+
+    for (int i = 0; i < size;)
     {
-        case REG_DISPCNT:   [[fallthrough]];
-        case REG_DISPCNT + 1:
-            stat->dispcnt.raw = (memory[REG_DISPCNT + 1] << 8) | (memory[REG_DISPCNT]);
+        IoRegister const *reg = io_table[offset + i];
 
-            // bgs enabled
-            stat->bgcnt[0].enabled = stat->dispcnt.bg_enabled & 0x1;
-            stat->bgcnt[1].enabled = stat->dispcnt.bg_enabled & 0x2;
-            stat->bgcnt[2].enabled = stat->dispcnt.bg_enabled & 0x4;
-            stat->bgcnt[3].enabled = stat->dispcnt.bg_enabled & 0x8;
-            break;
+        if (!reg || !reg->read)
+        {
+            value |= io[offset + i] << 8 * i;
+            ++i;
+            continue;
+        }
 
-        // REG_DISPSTAT
-        case REG_DISPSTAT:
-            // skip bits 0-2, unwritable
-            stat->dispstat.vbi = value >> 3 & 1;
-            stat->dispstat.hbi = value >> 4 & 1;
-            stat->dispstat.vci = value >> 5 & 1;
-            break;
+        u32 base = reg->address - MEM_IO_REG_START;
+        u32 data = reg->read(this, reg->address);
 
-        case REG_DISPSTAT + 1:
-            stat->dispstat.vct = value;
-            break;
+        for (; i < size && io_table[offset + i] == reg; ++i)
+            value |= (data >> 8 * (offset + i - base) & 0xFF) << 8 * i;
+    }
 
-        // REG_BG0CNT
-        case REG_BG0CNT:    [[fallthrough]];
-        case REG_BG0CNT + 1:
-            stat->bgcnt[0].raw = (memory[REG_BG0CNT + 1] << 8) | (memory[REG_BG0CNT]);
-            // bit 13 (affine_wrap) is unused in BG0CNT
-            stat->bgcnt[0].affine_wrap = 0;
-            memory[REG_BG0CNT + 1] = stat->bgcnt[0].raw >> 8;
-            memory[REG_BG0CNT] = stat->bgcnt[0].raw;
-            break;
+    return value;
+}
 
-        // REG_BG1CNT
-        case REG_BG1CNT:    [[fallthrough]];
-        case REG_BG1CNT + 1:
-            stat->bgcnt[1].raw = (memory[REG_BG1CNT + 1] << 8) | (memory[REG_BG1CNT]);
-            // bit 13 (affine_wrap) is unused in BG1CNT
-            stat->bgcnt[1].affine_wrap = 0;
-            memory[REG_BG1CNT + 1] = stat->bgcnt[1].raw >> 8;
-            memory[REG_BG1CNT] = stat->bgcnt[1].raw;
-            break;
+void Memory::writeIo(u32 address, u32 value, int size)
+{
+    u32 offset = address - MEM_IO_REG_START;
 
-        // REG_BG2CNT
-        case REG_BG2CNT:    [[fallthrough]];
-        case REG_BG2CNT + 1:
-            stat->bgcnt[2].raw = (memory[REG_BG2CNT + 1] << 8) | (memory[REG_BG2CNT]);
-            break;
+    if (offset >= MEM_IO_REG_SIZE)
+        return;
 
-        // REG_BG3CNT
-        case REG_BG3CNT:    [[fallthrough]];
-        case REG_BG3CNT + 1:
-            stat->bgcnt[3].raw = (memory[REG_BG3CNT + 1] << 8) | (memory[REG_BG3CNT]);
-            break;
+    for (int i = 0; i < size;)
+    {
+        IoRegister const *reg = io_table[offset + i];
 
-        // REG_BG0HOFS
-        case REG_BG0HOFS:   [[fallthrough]];
-        case REG_BG0HOFS + 1:
-            stat->bgcnt[0].hoff = (memory[REG_BG0HOFS + 1] << 8) | (memory[REG_BG0HOFS]);
-            break;
+        if (!reg)
+        {
+            io[offset + i] = value >> 8 * i;
+            ++i;
+            continue;
+        }
 
-        // REG_BG0VOFS
-        case REG_BG0VOFS:   [[fallthrough]];
-        case REG_BG0VOFS + 1:
-            stat->bgcnt[0].voff = (memory[REG_BG0VOFS + 1] << 8) | (memory[REG_BG0VOFS]);
-            break;
+        // store every byte of this register that was written, then let the handler see them together
+        u32 base = reg->address - MEM_IO_REG_START;
+        u32 mask = 0;
 
-        // REG_BG1HOFS
-        case REG_BG1HOFS:   [[fallthrough]];
-        case REG_BG1HOFS + 1:
-            stat->bgcnt[1].hoff = (memory[REG_BG1HOFS + 1] << 8) | (memory[REG_BG1HOFS]);
-            break;
+        for (; i < size && io_table[offset + i] == reg; ++i)
+        {
+            io[offset + i] = value >> 8 * i;
+            mask |= 1 << (offset + i - base);
+        }
 
-        // REG_BG1VOFS
-        case REG_BG1VOFS:   [[fallthrough]];
-        case REG_BG1VOFS + 1:
-            stat->bgcnt[1].voff = (memory[REG_BG1VOFS + 1] << 8) | (memory[REG_BG1VOFS]);
-            break;
+        if (reg->write)
+            reg->write(this, reg->address, mask);
+    }
+}
 
-        // REG_BG2HOFS
-        case REG_BG2HOFS:   [[fallthrough]];
-        case REG_BG2HOFS + 1:
-            stat->bgcnt[2].hoff = (memory[REG_BG2HOFS + 1] << 8) | (memory[REG_BG2HOFS]);
-            break;
+// io registers with side effects, by address
+// handlers find which of several identical registers they are from the address they are given
+void Memory::mapIo()
+{
+    // BGxCNT
+    static auto writeBgCnt = [](Memory *mem, u32 address, u32)
+    {
+        int n = (address - REG_BG0CNT) / 2;
+        auto &bg = mem->stat->bgcnt[n];
 
-        // REG_BG2VOFS
-        case REG_BG2VOFS:   [[fallthrough]];
-        case REG_BG2VOFS + 1:
-            stat->bgcnt[2].voff = (memory[REG_BG2VOFS + 1] << 8) | (memory[REG_BG2VOFS]);
-            break;
+        bg.raw = mem->ioReg(address + 1) << 8 | mem->ioReg(address);
 
-        // REG_BG3HOFS
-        case REG_BG3HOFS:   [[fallthrough]];
-        case REG_BG3HOFS + 1:
-            stat->bgcnt[3].hoff = (memory[REG_BG3HOFS + 1] << 8) | (memory[REG_BG3HOFS]);
-            break;
+        // bit 13 (affine_wrap) is unused in BG0CNT and BG1CNT
+        if (n < 2)
+        {
+            bg.affine_wrap = 0;
+            mem->ioReg(address + 1) = bg.raw >> 8;
+            mem->ioReg(address)     = bg.raw;
+        }
+    };
 
-        // REG_BG3VOFS
-        case REG_BG3VOFS:   [[fallthrough]];
-        case REG_BG3VOFS + 1:
-            stat->bgcnt[3].voff = (memory[REG_BG3VOFS + 1] << 8) | (memory[REG_BG3VOFS]);
-            break;
+    // BGxHOFS, BGxVOFS
+    static auto writeBgOffset = [](Memory *mem, u32 address, u32)
+    {
+        int n = (address - REG_BG0HOFS) / 4;
+        u16 offset = mem->ioReg(address + 1) << 8 | mem->ioReg(address);
 
-        // write into waitstate ctl
-        case WAITCNT:
-            switch(value >> 2 & 0b11) // bits 2-3
-            {
-                case 0: n_cycles = 4; break;
-                case 1: n_cycles = 3; break;
-                case 2: n_cycles = 2; break;
-                case 3: n_cycles = 8; break;
-            }
+        if ((address - REG_BG0HOFS) & 2)
+            mem->stat->bgcnt[n].voff = offset;
+        else
+            mem->stat->bgcnt[n].hoff = offset;
+    };
 
-            switch (value >> 4) // bit 4
-            {
-                case 0: s_cycles = 2; break;
-                case 1: s_cycles = 1; break;
-            }
+    // BGxX, BGxY reference points
+    static auto writeBgReference = [](Memory *mem, u32 address, u32)
+    {
+        int n = address >= REG_BG3X ? 3 : 2;
+        u32 point = mem->ioReg(address + 3) << 24 | mem->ioReg(address + 2) << 16 | mem->ioReg(address + 1) << 8 | mem->ioReg(address);
 
-            break;
+        // 28 bit signed, the new point takes effect on the next scanline
+        s32 ref = (s32) (point << 4) >> 4;
 
-        // REG_BG2X
-        case REG_BG2X + 0:  [[fallthrough]];
-        case REG_BG2X + 1:  [[fallthrough]];
-        case REG_BG2X + 2:  [[fallthrough]];
-        case REG_BG2X + 3:
-            stat->bgcnt[2].dx = (memory[REG_BG2X + 3] << 24) | (memory[REG_BG2X + 2] << 16) | (memory[REG_BG2X + 1] << 8) | (memory[REG_BG2X]);
-            break;
+        if ((address - REG_BG2X) & 4)
+        {
+            mem->stat->bgcnt[n].dy    = point;
+            mem->stat->bgcnt[n].ref_y = ref;
+        }
 
-        // REG_BG2Y
-        case REG_BG2Y + 0:  [[fallthrough]];
-        case REG_BG2Y + 1:  [[fallthrough]];
-        case REG_BG2Y + 2:  [[fallthrough]];
-        case REG_BG2Y + 3:
-            stat->bgcnt[2].dy = (memory[REG_BG2Y + 3] << 24) | (memory[REG_BG2Y + 2] << 16) | (memory[REG_BG2Y + 1] << 8) | (memory[REG_BG2Y]);
-            break;
+        else
+        {
+            mem->stat->bgcnt[n].dx    = point;
+            mem->stat->bgcnt[n].ref_x = ref;
+        }
+    };
 
-        // REG_BG3X
-        case REG_BG3X + 0:  [[fallthrough]];
-        case REG_BG3X + 1:  [[fallthrough]];
-        case REG_BG3X + 2:  [[fallthrough]];
-        case REG_BG3X + 3:
-            stat->bgcnt[3].dx = (memory[REG_BG3X + 3] << 24) | (memory[REG_BG3X + 2] << 16) | (memory[REG_BG3X + 1] << 8) | (memory[REG_BG3X]);
-            break;
+    // WINxH, WINxV
+    static auto writeWindowSize = [](Memory *mem, u32 address, u32)
+    {
+        int n = (address - REG_WIN0H) & 2 ? 1 : 0;
+        u16 size = mem->ioReg(address + 1) << 8 | mem->ioReg(address);
 
-        // REG_BG3Y
-        case REG_BG3Y + 0:  [[fallthrough]];
-        case REG_BG3Y + 1:  [[fallthrough]];
-        case REG_BG3Y + 2:  [[fallthrough]];
-        case REG_BG3Y + 3:
-            stat->bgcnt[3].dy = (memory[REG_BG3Y + 3] << 24) | (memory[REG_BG3Y + 2] << 16) | (memory[REG_BG3Y + 1] << 8) | (memory[REG_BG3Y]);
-            break;
-        
-        // Window controls
+        if (address >= REG_WIN0V)
+            mem->stat->writeWinv(n, size);
+        else
+            mem->stat->writeWinh(n, size);
+    };
 
-        // REG_WIN0H
-        case REG_WIN0H:     [[fallthrough]];
-        case REG_WIN0H + 1:
-            stat->writeWinh(0, memory[REG_WIN0H + 1] << 8 | memory[REG_WIN0H]);
-            break;
-        
-        // REG_WIN0H
-        case REG_WIN0V:     [[fallthrough]];
-        case REG_WIN0V + 1:
-            stat->writeWinv(0, memory[REG_WIN0V + 1] << 8 | memory[REG_WIN0V]);
-            break;
-        
-        // REG_WIN1H
-        case REG_WIN1H:     [[fallthrough]];
-        case REG_WIN1H + 1:
-            stat->writeWinh(1, memory[REG_WIN1H + 1] << 8 | memory[REG_WIN1H]);
-            break;
-        
-        // REG_WIN1V
-        case REG_WIN1V:     [[fallthrough]];
-        case REG_WIN1V + 1:
-            stat->writeWinv(1, memory[REG_WIN1V + 1] << 8 | memory[REG_WIN1V]);
-            break;
-        
-        // REG_WININ
-        case REG_WININ:
-            // bits 6 - 7 not used
-            value &= 0x3F;
-            memory[address] = value;
-            stat->writeWindowContent(CONTENT_WIN0, value);
-            break;
-        
-        // REG_WININ + 1
-        case REG_WININ + 1:
-            // bits 13 - 14 not used
-            value &= 0x3F;
-            memory[address] = value;
-            stat->writeWindowContent(CONTENT_WIN1, value);
-            break;
-        
-        // REG_WINOUT
-        case REG_WINOUT:
-            // bits 6 - 7 not used
-            value &= 0x3F;
-            memory[address] = value;
-            stat->writeWindowContent(CONTENT_WINOUT, value);
-            break;
-        
-        // REG_WINOUT + 1
-        case REG_WINOUT + 1:
-            // bits 13 - 14 not used
-            value &= 0x3F;
-            memory[address] = value;
-            stat->writeWindowContent(CONTENT_WINOBJ, value);
-            break;
+    // WININ, WINOUT
+    static auto writeWindowContent = [](Memory *mem, u32 address, u32 mask)
+    {
+        int content = address == REG_WININ ? CONTENT_WIN0 : CONTENT_WINOUT;
 
-        // DMA
+        for (int i = 0; i < 2; ++i)
+        {
+            if (!(mask & 1 << i))
+                continue;
 
-        // REG_DMA0CNT
-        case REG_DMA0CNT:   [[fallthrough]];
-        case REG_DMA0CNT + 1:
-            dma[0].num_transfers = (memory[REG_DMA0CNT + 1] << 8) | (memory[REG_DMA0CNT]);
-            break;
+            // bits 6 - 7 and 13 - 14 not used
+            mem->ioReg(address + i) &= 0x3F;
+            mem->stat->writeWindowContent((WindowContent) (content + i), mem->ioReg(address + i));
+        }
+    };
 
-       case REG_DMA0CNT + 2:
-            dma[0].dest_adjust   = value >> 5 & 0x3;
-            break;
+    // DMAxCNT, an immediate transfer starts when the enable bit is written
+    static auto writeDmaCnt = [](Memory *mem, u32 address, u32 mask)
+    {
+        int n = (address - REG_DMA0CNT) / 12;
+        auto &dma = mem->dma[n];
+        u8 *cnt = &mem->ioReg(address);
 
-        case REG_DMA0CNT + 3:
-            dma[0].src_adjust     = ((memory[REG_DMA0CNT + 3] & 1) << 1) | (memory[REG_DMA0CNT + 2] >> 7);
-            dma[0].repeat         = value >> 1 & 0x1;
-            dma[0].chunk_size     = value >> 2 & 0x1;
-            dma[0].mode           = value >> 4 & 0x3;
-            dma[0].irq            = value >> 6 & 0x1;
-            dma[0].enable         = value >> 7 & 0x1;
+        if (mask & 0b0011)
+            dma.num_transfers = cnt[1] << 8 | cnt[0];
 
-            if (dma[0].enable && dma[0].mode == 0) // immediate mode
-            {
-                //log(LogLevel::Message, "DMA0 immediate\n");
-                _dma(0);
+        if (mask & 0b0100)
+            dma.dest_adjust = cnt[2] >> 5 & 0x3;
 
-                // disable DMA after immediate transfer
-                dma[0].enable = 0;
-            }
+        if (!(mask & 0b1000))
+            return;
 
-            break;
+        dma.src_adjust = (cnt[3] & 1) << 1 | cnt[2] >> 7;
+        dma.repeat     = cnt[3] >> 1 & 0x1;
+        dma.chunk_size = cnt[3] >> 2 & 0x1;
+        dma.mode       = cnt[3] >> 4 & 0x3;
+        dma.irq        = cnt[3] >> 6 & 0x1;
+        dma.enable     = cnt[3] >> 7 & 0x1;
 
-        // REG_DMA1CNT
-        case REG_DMA1CNT:   [[fallthrough]];
-        case REG_DMA1CNT + 1:
-            dma[1].num_transfers = (memory[REG_DMA1CNT + 1] << 8) | (memory[REG_DMA1CNT]);
-            break;
+        mem->armDma(n);
+    };
 
-        case REG_DMA1CNT + 2:
-            dma[1].dest_adjust   = value >> 5 & 0x3;
-            break;
+    // TMxD, reads give the counter and writes set the reload value
+    static auto readTimer = [](Memory *mem, u32 address) -> u32
+    {
+        return mem->timer->read((address - REG_TM0D) / 4);
+    };
 
-        case REG_DMA1CNT + 3:
-            dma[1].src_adjust     = ((memory[REG_DMA1CNT + 3] & 1) << 1) | (memory[REG_DMA1CNT + 2] >> 7);
-            dma[1].repeat         = value >> 1 & 0x1;
-            dma[1].chunk_size     = value >> 2 & 0x1;
-            dma[1].mode           = value >> 4 & 0x3;
-            dma[1].irq            = value >> 6 & 0x1;
-            dma[1].enable         = value >> 7 & 0x1;
+    static auto writeTimer = [](Memory *mem, u32 address, u32)
+    {
+        mem->timer->write((address - REG_TM0D) / 4, mem->ioReg(address + 1) << 8 | mem->ioReg(address));
+    };
 
-            if (dma[1].enable && dma[1].mode == 0) // immediate mode
-            {
-                //log(LogLevel::Message, "DMA1 immediate\n");
-                _dma(1);
+    // TMxCNT, the upper byte is unused
+    static auto writeTimerCnt = [](Memory *mem, u32 address, u32 mask)
+    {
+        if (mask & 1)
+            mem->timer->writeCnt((address - REG_TM0CNT) / 4, mem->ioReg(address));
+    };
 
-                // disable DMA after immediate transfer
-                dma[1].enable = 0;
+    static IoRegister const registers[] =
+    {
+        // display
+        { REG_DISPCNT, 2, nullptr, [](Memory *mem, u32, u32)
+        {
+            mem->stat->dispcnt.raw = mem->ioReg(REG_DISPCNT + 1) << 8 | mem->ioReg(REG_DISPCNT);
+
+            // bgs enabled
+            for (int i = 0; i < 4; ++i)
+                mem->stat->bgcnt[i].enabled = mem->stat->dispcnt.bg_enabled >> i & 1;
+        }},
+
+        { REG_DISPSTAT, 2, [](Memory *mem, u32) -> u32 { return mem->stat->dispstat.raw; }, [](Memory *mem, u32, u32 mask)
+        {
+            // skip bits 0-2, unwritable
+            if (mask & 1)
+            {
+                u8 value = mem->ioReg(REG_DISPSTAT);
+                mem->stat->dispstat.vbi = value >> 3 & 1;
+                mem->stat->dispstat.hbi = value >> 4 & 1;
+                mem->stat->dispstat.vci = value >> 5 & 1;
             }
 
-            break;
+            if (mask & 2)
+                mem->stat->dispstat.vct = mem->ioReg(REG_DISPSTAT + 1);
+        }},
+
+        { REG_VCOUNT, 2, [](Memory *mem, u32) -> u32 { return mem->stat->scanline; }, nullptr },
+
+        // backgrounds
+        { REG_BG0CNT,  2, nullptr, writeBgCnt },
+        { REG_BG1CNT,  2, nullptr, writeBgCnt },
+        { REG_BG2CNT,  2, nullptr, writeBgCnt },
+        { REG_BG3CNT,  2, nullptr, writeBgCnt },
+
+        { REG_BG0HOFS, 2, nullptr, writeBgOffset },
+        { REG_BG0VOFS, 2, nullptr, writeBgOffset },
+        { REG_BG1HOFS, 2, nullptr, writeBgOffset },
+        { REG_BG1VOFS, 2, nullptr, writeBgOffset },
+        { REG_BG2HOFS, 2, nullptr, writeBgOffset },
+        { REG_BG2VOFS, 2, nullptr, writeBgOffset },
+        { REG_BG3HOFS, 2, nullptr, writeBgOffset },
+        { REG_BG3VOFS, 2, nullptr, writeBgOffset },
+
+        { REG_BG2X,    4, nullptr, writeBgReference },
+        { REG_BG2Y,    4, nullptr, writeBgReference },
+        { REG_BG3X,    4, nullptr, writeBgReference },
+        { REG_BG3Y,    4, nullptr, writeBgReference },
+
+        // windows
+        { REG_WIN0H,   2, nullptr, writeWindowSize },
+        { REG_WIN1H,   2, nullptr, writeWindowSize },
+        { REG_WIN0V,   2, nullptr, writeWindowSize },
+        { REG_WIN1V,   2, nullptr, writeWindowSize },
+        { REG_WININ,   2, nullptr, writeWindowContent },
+        { REG_WINOUT,  2, nullptr, writeWindowContent },
 
-        // REG_DMA2CNT
-        case REG_DMA2CNT:   [[fallthrough]];
-        case REG_DMA2CNT + 1:
-            dma[2].num_transfers = (memory[REG_DMA2CNT + 1] << 8) | (memory[REG_DMA2CNT]);
-            break;
+        // DMA
+        { REG_DMA0CNT, 4, nullptr, writeDmaCnt },
+        { REG_DMA1CNT, 4, nullptr, writeDmaCnt },
+        { REG_DMA2CNT, 4, nullptr, writeDmaCnt },
+        { REG_DMA3CNT, 4, nullptr, writeDmaCnt },
 
-        case REG_DMA2CNT + 2:
-            dma[2].dest_adjust   = value >> 5 & 0x3;
-            break;
+        // timers
+        { REG_TM0D,    2, readTimer, writeTimer },
+        { REG_TM1D,    2, readTimer, writeTimer },
+        { REG_TM2D,    2, readTimer, writeTimer },
+        { REG_TM3D,    2, readTimer, writeTimer },
+        { REG_TM0CNT,  2, nullptr,   writeTimerCnt },
+        { REG_TM1CNT,  2, nullptr,   writeTimerCnt },
+        { REG_TM2CNT,  2, nullptr,   writeTimerCnt },
+        { REG_TM3CNT,  2, nullptr,   writeTimerCnt },
+
+        // keypad
+        { REG_KEYINPUT, 2, [](Memory *mem, u32) -> u32 { return mem->gamepad->keys.raw; }, nullptr },
+        { REG_KEYCNT,   2, nullptr, [](Memory *mem, u32, u32)
+        {
+            mem->gamepad->keycnt.raw = mem->ioReg(REG_KEYCNT + 1) << 8 | mem->ioReg(REG_KEYCNT);
+        }},
 
-        case REG_DMA2CNT + 3:
-            dma[2].src_adjust     = ((memory[REG_DMA2CNT + 3] & 1) << 1) | (memory[REG_DMA2CNT + 2] >> 7);
-            dma[2].repeat         = value >> 1 & 0x1;
-            dma[2].chunk_size     = value >> 2 & 0x1;
-            dma[2].mode           = value >> 4 & 0x3;
-            dma[2].irq            = value >> 6 & 0x1;
-            dma[2].enable         = value >> 7 & 0x1;
+        // interrupts, only the bytes written to IF acknowledge anything
+        { REG_IE,  2, [](Memory *, u32) -> u32 { return irq->getIE(); }, [](Memory *mem, u32, u32)
+        {
+            irq->setIE(mem->ioReg(REG_IE + 1) << 8 | mem->ioReg(REG_IE));
+        }},
 
-            if (dma[2].enable && dma[2].mode == 0) // immediate mode
-            {
-                //(LogLevel::Message, "DMA2 immediate\n");
-                _dma(2);
+        { REG_IF,  2, [](Memory *, u32) -> u32 { return irq->getIF(); }, [](Memory *mem, u32, u32 mask)
+        {
+            u16 value   = mem->ioReg(REG_IF + 1) << 8 | mem->ioReg(REG_IF);
+            u16 written = (mask & 1 ? 0x00FF : 0) | (mask & 2 ? 0xFF00 : 0);
+            irq->clear(value & written);
+        }},
 
-                // disable DMA after immediate transfer
-                dma[2].enable = 0;
-            }
+        { REG_IME, 2, [](Memory *, u32) -> u32 { return irq->getIME(); }, [](Memory *mem, u32, u32)
+        {
+            irq->setIME(mem->ioReg(REG_IME + 1) << 8 | mem->ioReg(REG_IME));
+        }},
 
-            break;
+        // write into waitstate ctl
+        { WAITCNT, 2, nullptr, [](Memory *mem, u32, u32) { mem->updateWaitstates(); }},
 
-        // REG_DMA3CNT
-        case REG_DMA3CNT:   [[fallthrough]];
-        case REG_DMA3CNT + 1:
-            dma[3].num_transfers = (memory[REG_DMA3CNT + 1] << 8) | (memory[REG_DMA3CNT]);
-            break;
+        // bit 7 selects stop mode, otherwise the cpu halts until an interrupt is requested
+        { REG_HALTCNT, 1, nullptr, [](Memory *mem, u32, u32)
+        {
+            mem->halt_state = mem->ioReg(REG_HALTCNT) >> 7 ? HaltState::STOP : HaltState::HALT;
+        }},
+    };
 
-        case REG_DMA3CNT + 2:
-            dma[3].dest_adjust   = value >> 5 & 0x3;
-            break;
+    for (auto &reg : io_table)
+        reg = nullptr;
 
-        case REG_DMA3CNT + 3:
-            dma[3].src_adjust     = ((memory[REG_DMA3CNT + 3] & 1) << 1) | (memory[REG_DMA3CNT + 2] >> 7);
-            dma[3].repeat         = value >> 1 & 0x1;
-            dma[3].chunk_size     = value >> 2 & 0x1;
-            dma[3].mode           = value >> 4 & 0x3;
-            dma[3].irq            = value >> 6 & 0x1;
-            dma[3].enable         = value >> 7 & 0x1;
+    for (auto const &reg : registers)
+    {
+        for (int i = 0; i < reg.size; ++i)
+            io_table[reg.address - MEM_IO_REG_START + i] = &reg;
+    }
+}
 
-            if (dma[3].enable && dma[3].mode == 0) // immediate mode
-            {
-                //log(LogLevel::Message, "DMA3 immediate\n");
-                _dma(3);
+// rebuild access_cycles from WAITCNT
+// 32 bit accesses on a 16 bit bus take two, the second one sequential
+void Memory::updateWaitstates()
+{
+    static constexpr u8 first[4] = { 4, 3, 2, 8 };  // gamepak N waitstates, by WAITCNT field
+    static constexpr u8 second[3][2] =              // gamepak S waitstates for ws0 - ws2, by WAITCNT bit
+    {
+        { 2, 1 },
+        { 4, 1 },
+        { 8, 1 },
+    };
+
+    u16 waitcnt = ioReg(WAITCNT + 1) << 8 | ioReg(WAITCNT);
+
+    // BIOS, IWRAM, io and OAM are 32 bit with no waitstates
+    for (auto &region : access_cycles)
+        region[0][0] = region[0][1] = region[1][0] = region[1][1] = 1;
+
+    // 16 bit buses
+    auto setRegion = [this](int region, int n, int s)
+    {
+        access_cycles[region][0][0] = n;
+        access_cycles[region][0][1] = s;
+        access_cycles[region][1][0] = n + s;
+        access_cycles[region][1][1] = s + s;
+    };
+
+    setRegion(0x2, 3, 3); // EWRAM
+    setRegion(0x5, 1, 1); // Palette RAM
+    setRegion(0x6, 1, 1); // VRAM
+
+    // gamepak ROM, through waitstates 0 - 2
+    for (int ws = 0; ws < 3; ++ws)
+    {
+        int n = 1 + first[waitcnt >> (2 + 3 * ws) & 0x3];
+        int s = 1 + second[ws][waitcnt >> (4 + 3 * ws) & 0x1];
+
+        setRegion(0x8 + 2 * ws, n, s);
+        setRegion(0x9 + 2 * ws, n, s);
+    }
+
+    // cart RAM, 8 bit bus
+    for (int region = 0xE; region <= 0xF; ++region)
+    {
+        for (auto &width : access_cycles[region])
+            width[0] = width[1] = 1 + first[waitcnt & 0x3];
+    }
+}
 
-                // disable DMA after immediate transfer
-                dma[3].enable = 0;
+u16 Memory::read16Slow(u32 address)
+{
+    if ((address & 1) == 0)
+    {
+        switch (address >> 24)
+        {
+            // MMIO
+            case 0x4:
+                return readIo(address, 2);
+
+            // Palette RAM, OAM
+            case 0x5:
+            case 0x7:
+            {
+                u16 value;
+                memcpy(&value, backing(address), sizeof(value));
+                return value;
             }
+        }
+    }
 
-        break;
+    return (read8(address + 1) << 8) | read8(address);
+}
 
-        // timers
+u32 Memory::read32Slow(u32 address)
+{
+    if ((address & 3) == 0)
+    {
+        switch (address >> 24)
+        {
+            // MMIO
+            case 0x4:
+                return readIo(address, 4);
 
-        // REG_TM0D
-        case REG_TM0D:  [[fallthrough]];
-        case REG_TM0D + 1:
-            timer->write(0, memory[REG_TM0D + 1] << 8 | memory[REG_TM0D]);
-            break;
-        
-        // REG_TM1D
-        case REG_TM1D:  [[fallthrough]];
-        case REG_TM1D + 1:
-            timer->write(1, memory[REG_TM1D + 1] << 8 | memory[REG_TM1D]);
-            break;
-        
-        // REG_TM2D
-        case REG_TM2D:  [[fallthrough]];
-        case REG_TM2D + 1:
-            timer->write(2, memory[REG_TM2D + 1] << 8 | memory[REG_TM2D]);
-            break;
-        
-        // REG_TM3D
-        case REG_TM3D:  [[fallthrough]];
-        case REG_TM3D + 1:
-            timer->write(3, memory[REG_TM3D + 1] << 8 | memory[REG_TM3D]);
-            break;
+            // Palette RAM, OAM
+            case 0x5:
+            case 0x7:
+            {
+                u32 value;
+                memcpy(&value, backing(address), sizeof(value));
+                return value;
+            }
+        }
+    }
 
-        // REG_TM0CNT
-        case REG_TM0CNT:
-            timer->writeCnt(0, memory[REG_TM0CNT]);
-            break;
-        
-        // REG_TM1CNT
-        case REG_TM1CNT:
-            timer->writeCnt(1, memory[REG_TM1CNT]);
-            break;
-        
-        // REG_TM2CNT
-        case REG_TM2CNT:
-            timer->writeCnt(2, memory[REG_TM2CNT]);
-            break;
-        
-        // REG_TM3CNT
-        case REG_TM3CNT:
-            timer->writeCnt(3, memory[REG_TM3CNT]);
-            break;
+    return (read8(address + 3) << 24)
+    | (read8(address + 2) << 16)
+    | (read8(address + 1) << 8)
+    | read8(address);
+}
 
-        // REG_KEYCNT
-        case REG_KEYCNT: [[fallthrough]];
-        case REG_KEYCNT + 1:
-            gamepad->keycnt.raw = memory[REG_KEYCNT + 1] << 8 | memory[REG_KEYCNT];
-            break;
-        
-        // REG_IF
-        case REG_IF:    [[fallthrough]];
-        case REG_IF + 1:
-            irq->clear(memory[REG_IF + 1] << 8 | memory[REG_IF]);
-            break;
-        
-        // REG_IE
-        case REG_IE:    [[fallthrough]];
-        case REG_IE + 1:
-            irq->setIE(memory[REG_IE + 1] << 8 | memory[REG_IE]);
-            break;
-        
-        // REG_IME
-        case REG_IME:    [[fallthrough]];
-        case REG_IME + 1:
-            irq->setIME(memory[REG_IME + 1] << 8 | memory[REG_IME]);
-            break;
+void Memory::write16Slow(u32 address, u16 value)
+{
+    if ((address & 1) == 0)
+    {
+        switch (address >> 24)
+        {
+            // MMIO
+            case 0x4:
+                writeIo(address, value, 2);
+                return;
+
+            // OAM
+            case 0x7:
+                stat->oam_changed = true;
+                [[fallthrough]];
+
+            // Palette RAM
+            case 0x5:
+                memcpy(backing(address), &value, sizeof(value));
+                return;
+        }
     }
+
+    write8(address    , (value >> 0) & 0xFF);
+    write8(address + 1, (value >> 8) & 0xFF);
+}
+
+void Memory::write32Slow(u32 address, u32 value)
+{
+    if ((address & 3) == 0)
+    {
+        switch (address >> 24)
+        {
+            // MMIO
+            case 0x4:
+                writeIo(address, value, 4);
+                return;
+
+            // OAM
+            case 0x7:
+                stat->oam_changed = true;
+                [[fallthrough]];
+
+            // Palette RAM
+            case 0x5:
+                memcpy(backing(address), &value, sizeof(value));
+                return;
+        }
+    }
+
+    write8(address    , (value >>  0) & 0xFF);
+    write8(address + 1, (value >>  8) & 0xFF);
+    write8(address + 2, (value >> 16) & 0xFF);
+    write8(address + 3, (value >> 24) & 0xFF);
 }
 
 u32 Memory::read32Unsafe(u32 address)
@@ -836,7 +1012,8 @@ u16 Memory::read16Unsafe(u32 address)
 
 u8 Memory::read8Unsafe(u32 address)
 {
-    return memory[address];
+    u8 *ptr = backing(address);
+    return ptr ? *ptr : 0;
 }
 
 void Memory::write32Unsafe(u32 address, u32 value)
@@ -855,387 +1032,251 @@ void Memory::write16Unsafe(u32 address, u16 value)
 
 void Memory::write8Unsafe(u32 address, u8 value)
 {
-    memory[address] = value;
-}
-
-void Memory::_dma(int n)
-{
-    switch (n)
+    if (u8 *ptr = backing(address))
     {
-        case 0: dma0(); break;
-        case 1: dma1(); break;
-        case 2: dma2(); break;
-        case 3: dma3(); break;
-
-        default: // should never happen
-            log(LogLevel::Error, "Error: accessing unknown DMA: {}\n", n);
+        *ptr = value;
+        invalidate(address);
     }
 }
 
-void Memory::dma0()
+// a run of bytes within one page
+void Memory::invalidate(u32 address, u32 length)
 {
-    // log(LogLevel::Message, "DMA 0\n");
-    u32 dest_ptr, src_ptr, original_src, original_dest;
-    src_ptr  = original_src  = read32Unsafe(REG_DMA0SAD) & 0x7FFFFFF; // 27 bit
-    dest_ptr = original_dest = read32Unsafe(REG_DMA0DAD) & 0x7FFFFFF; // 27 bit;
+    if (block_cache)
+        block_cache->invalidate(address, length);
 
-    // log(LogLevel::Debug, "DMA 0 start addr: 0x{x}\n", src_ptr);
-    // log(LogLevel::Debug, "DMA 0 dest  addr: 0x{x}\n", dest_ptr);
-    // log(LogLevel::Debug, "DMA 0 num transfers: {}\n", dma[0].num_transfers);
-
-    // increment for destination, src
-    int dest_inc, src_inc;
-
-    // get increment mode for destination
-    switch (dma[0].dest_adjust)
+    if ((address >> 24) == 0x6 && length)
     {
-        case 0: dest_inc =  1; break;  // increment after each copy
-        case 1: dest_inc = -1; break;  // decrement after each copy
-        case 2: dest_inc =  0; break;  // leave unchanged
-        case 3: dest_inc =  1; break;  // increment after each copy, reset after transfer
-        default: // should never happen
-            log(LogLevel::Error, "Error: Illegal option for DMA 0 dest adjust: {}\n", (int) dma[0].dest_adjust);
-            break;
-    }
+        u32 first = vramOffset(address) / VRAM_TILE_SIZE;
+        u32 last  = vramOffset(address + length - 1) / VRAM_TILE_SIZE;
 
-    // get increment mode for destination
-    switch (dma[0].src_adjust)
-    {
-        case 0: src_inc =  1; break; // increment after each copy
-        case 1: src_inc = -1; break; // decrement after each copy
-        case 2: src_inc =  0; break; // leave unchanged
-        default: // should never happen
-            log(LogLevel::Error, "Error: Illegal option for DMA 0 src adjust: {}\n", (int) dma[0].src_adjust);
-            break;
-    }
-
-    // 32 bit copy
-    if (dma[0].chunk_size == 1)
-    {
-        for (int i = 0; i < dma[0].num_transfers; ++i)
-        {
-            // copy memory from src address to dest address
-            write32(dest_ptr, read32(src_ptr));
-
-            // increment src, dest ptrs
-            src_ptr  += src_inc  * sizeof(u32);
-            dest_ptr += dest_inc * sizeof(u32);
-        }
+        for (u32 tile = first; tile <= last; ++tile)
+            vram_dirty[tile / 64] |= 1ull << (tile % 64);
     }
+}
 
-    // 16 bit copy
-    else
-    {
-        for (int i = 0; i < dma[0].num_transfers; ++i)
-        {
-            // copy memory from src address to dest address
-            write16(dest_ptr, read16(src_ptr));
-
-            // increment src, dest ptrs
-            src_ptr  += src_inc  * sizeof(u16);
-            dest_ptr += dest_inc * sizeof(u16);
-        }
-    }
-
-    // reset initial destination address if required
-    if (dma[0].dest_adjust == 3)
-        dest_ptr = original_dest;
-
-    // write back dest
-    write32Unsafe(REG_DMA0DAD, dest_ptr);
-
-    // write back src
-    write32Unsafe(REG_DMA0SAD, src_ptr);
-
-
-    // turn off this transfer if repeat bit is not set
-    if (dma[0].repeat == 0)
-        dma[0].enable = 0;
+// source and destination address masks of each channel
+static constexpr u32 dma_src_mask[4]  = { 0x7FFFFFF, 0xFFFFFFF, 0xFFFFFFF, 0xFFFFFFF };
+static constexpr u32 dma_dest_mask[4] = { 0x7FFFFFF, 0x7FFFFFF, 0x7FFFFFF, 0xFFFFFFF };
 
-    // IRQ request
-    if (dma[0].irq)
+// DMA transfer routine, for all four channels
+// runs of plain memory on both ends are copied or filled in bulk, anything else one unit at a time
+void Memory::_dma(int n)
+{
+    if (n < 0 || n > 3) // should never happen
     {
-        log(LogLevel::Debug, "DMA0 IRQ request\n");
-        irq->raise(InterruptOccasion::DMA0);
+        log(LogLevel::Error, "Error: accessing unknown DMA: {}\n", n);
+        return;
     }
 
-    //log(LogLevel::Debug, "DMA 0 Done\n");
-}
+    auto &channel = dma[n];
 
-void Memory::dma1()
-{
-    //log(LogLevel::Debug, "DMA 1\n");
-    u32 dest_ptr, src_ptr, original_src, original_dest;
-    src_ptr  = original_src  = read32Unsafe(REG_DMA1SAD) & 0xFFFFFFF; // 28 bit
-    dest_ptr = original_dest = read32Unsafe(REG_DMA1DAD) & 0x7FFFFFF; // 27 bit
+    u32 sad = REG_DMA0SAD + 12 * n;
+    u32 dad = REG_DMA0DAD + 12 * n;
 
-    // log(LogLevel::Debug, "DMA 1 start addr: 0x{x}\n", src_ptr);
-    // log(LogLevel::Debug, "DMA 1 dest  addr: 0x{x}\n", dest_ptr);
-    // log(LogLevel::Debug, "DMA 1 num transfers: {}\n", dma[1].num_transfers);
+    // transfers are aligned to the unit size
+    u32 size = channel.chunk_size ? sizeof(u32) : sizeof(u16);
+    u32 src_ptr  = read32Unsafe(sad) & dma_src_mask[n]  & ~(size - 1);
+    u32 dest_ptr = read32Unsafe(dad) & dma_dest_mask[n] & ~(size - 1);
+    u32 original_dest = dest_ptr;
 
     // increment for destination, src
     int dest_inc, src_inc;
 
     // get increment mode for destination
-    switch (dma[1].dest_adjust)
+    switch (channel.dest_adjust)
     {
         case 0: dest_inc =  1; break;  // increment after each copy
         case 1: dest_inc = -1; break;  // decrement after each copy
         case 2: dest_inc =  0; break;  // leave unchanged
         case 3: dest_inc =  1; break;  // increment after each copy, reset after transfer
-        default: // should never happen
-            log(LogLevel::Error, "Error: Illegal option for DMA 1 dest adjust: {}\n", (int) dma[1].dest_adjust);
-        break;
     }
 
-    // get increment mode for destination
-    switch (dma[1].src_adjust)
+    // get increment mode for src
+    switch (channel.src_adjust)
     {
         case 0: src_inc =  1; break; // increment after each copy
         case 1: src_inc = -1; break; // decrement after each copy
         case 2: src_inc =  0; break; // leave unchanged
-        default: // should never happen
-            log(LogLevel::Error, "Error: Illegal option for DMA 1 src adjust: {}\n", (int) dma[1].src_adjust);
+        default: // prohibited
+            log(LogLevel::Error, "Error: Illegal option for DMA {} src adjust: {}\n", n, (int) channel.src_adjust);
+            src_inc = 1;
             break;
     }
 
-    // 32 bit copy
-    if (dma[1].chunk_size == 1)
+    u32 src_start  = src_ptr;
+    u32 dest_start = dest_ptr;
+    u32 remaining  = channel.num_transfers;
+
+    while (remaining > 0)
     {
-        for (int i = 0; i < dma[1].num_transfers; ++i)
-        {
-            // copy memory from src address to dest address
-            write32(dest_ptr, read32(src_ptr));
+        u32 units = 0;
 
-            // increment src, dest ptrs
-            src_ptr  += src_inc  * sizeof(u32);
-            dest_ptr += dest_inc * sizeof(u32);
-        }
-    }
+        // an incrementing destination in plain memory, from incrementing or fixed plain memory
+        if (dest_inc == 1 && src_inc >= 0)
+            units = dmaBulk(src_ptr, dest_ptr, size, src_inc == 1, remaining);
 
-    // 16 bit copy
-    else
-    {
-        for (int i = 0; i < dma[1].num_transfers; ++i)
+        if (units == 0)
         {
             // copy memory from src address to dest address
-            write16(dest_ptr, read16(src_ptr));
+            if (size == sizeof(u32))
+                write32(dest_ptr, read32(src_ptr));
+            else
+                write16(dest_ptr, read16(src_ptr));
 
-            // increment src, dest ptrs
-            src_ptr  += src_inc  * sizeof(u16);
-            dest_ptr += dest_inc * sizeof(u16);
+            units = 1;
         }
+
+        // increment src, dest ptrs
+        src_ptr   += src_inc  * size * units;
+        dest_ptr  += dest_inc * size * units;
+        remaining -= units;
     }
 
     // reset initial destination address if required
-    if (dma[1].dest_adjust == 3)
+    if (channel.dest_adjust == 3)
         dest_ptr = original_dest;
 
     // write back dest
-    write32Unsafe(REG_DMA1DAD, dest_ptr);
+    write32Unsafe(dad, dest_ptr);
 
     // write back src
-    write32Unsafe(REG_DMA1SAD, src_ptr);
+    write32Unsafe(sad, src_ptr);
 
+    // 2N + 2(n - 1)S + 2I, timed by the regions the transfer started in
+    if (channel.num_transfers > 0)
+    {
+        bool word = size == sizeof(u32);
 
-    // turn off this transfer if repeat bit is not set
-    if (dma[1].repeat == 0)
-        dma[1].enable = 0;
+        dma_cycles += accessCycles(src_start, word, false) + accessCycles(dest_start, word, false)
+            + (channel.num_transfers - 1) * (accessCycles(src_start, word, true) + accessCycles(dest_start, word, true))
+            + 2;
+    }
 
-    // IRQ request
-    if (dma[1].irq)
+    // turn off this transfer if repeat bit is not set, immediate transfers never repeat
+    if (channel.repeat == 0 || channel.mode == 0)
     {
-        log(LogLevel::Debug, "DMA1 IRQ request\n");
-        irq->raise(InterruptOccasion::DMA1);
+        channel.enable = 0;
+        ioReg(REG_DMA0CNT + 12 * n + 3) &= 0x7F;
+        armDma(n);
     }
 
-    //log(LogLevel::Debug, "DMA 1 Done\n");
+    // IRQ request
+    if (channel.irq)
+        irq->raise(static_cast<InterruptOccasion>(static_cast<int>(InterruptOccasion::DMA0) + n));
 }
 
-void Memory::dma2()
+// keep a channel's start condition in line with its control register
+void Memory::armDma(int n)
 {
-    //log(LogLevel::Debug, "DMA 2\n");
-    u32 dest_ptr, src_ptr, original_src, original_dest;
-    src_ptr  = original_src  = read32Unsafe(REG_DMA2SAD) & 0xFFFFFFF; // 28 bit
-    dest_ptr = original_dest = read32Unsafe(REG_DMA2DAD) & 0x7FFFFFF; // 27 bit;
+    for (auto &armed : dma_armed)
+        armed &= ~(1 << n);
 
-    // log(LogLevel::Debug, "DMA 2 start addr: 0x{x}\n", src_ptr);
-    // log(LogLevel::Debug, "DMA 2 dest  addr: 0x{x}\n", dest_ptr);
-    // log(LogLevel::Debug, "DMA 2 num transfers: {}\n", dma[2].num_transfers);
+    if (!dma[n].enable)
+        return;
 
-    // increment for destination, src
-    int dest_inc, src_inc;
+    if (dma[n].mode == 0)
+        scheduleDma(n);
+    else
+        dma_armed[dma[n].mode] |= 1 << n;
+}
 
-    // get increment mode for destination
-    switch (dma[2].dest_adjust)
-    {
-        case 0: dest_inc =  1; break;  // increment after each copy
-        case 1: dest_inc = -1; break;  // decrement after each copy
-        case 2: dest_inc =  0; break;  // leave unchanged
-        case 3: dest_inc =  1; break;  // increment after each copy, reset after transfer
-        default: // should never happen
-            log(LogLevel::Error, "Error: Illegal option for DMA 2 dest adjust: {}\n", (int) dma[2].dest_adjust);
-            break;
-    }
+void Memory::triggerDma(DmaTiming timing, u8 channels)
+{
+    u8 armed = dma_armed[static_cast<int>(timing)] & channels;
 
-    // get increment mode for destination
-    switch (dma[2].src_adjust)
+    // lowest channel first, it has the highest priority
+    for (int n = 0; armed; ++n, armed >>= 1)
     {
-        case 0: src_inc =  1; break; // increment after each copy
-        case 1: src_inc = -1; break; // decrement after each copy
-        case 2: src_inc =  0; break; // leave unchanged
-        default: // should never happen
-            log(LogLevel::Error, "Error: Illegal option for DMA 2 src adjust: {}\n", (int) dma[2].src_adjust);
-            break;
+        if (armed & 1)
+            scheduleDma(n);
     }
+}
 
-    // 32 bit copy
-    if (dma[2].chunk_size == 1)
-    {
-        for (int i = 0; i < dma[2].num_transfers; ++i)
-        {
-            // copy memory from src address to dest address
-            write32(dest_ptr, read32(src_ptr));
+// channels take the bus 2 cycles after they are started
+void Memory::scheduleDma(int n)
+{
+    dma_starting |= 1 << n;
+    scheduler->add(2, dma_event[n], dma_handler[n], this);
+}
 
-            // increment src, dest ptrs
-            src_ptr  += src_inc  * sizeof(u32);
-            dest_ptr += dest_inc * sizeof(u32);
-        }
-    }
+void Memory::startDma(int n)
+{
+    dma_starting &= ~(1 << n);
 
-    // 16 bit copy
-    else
-    {
-        for (int i = 0; i < dma[2].num_transfers; ++i)
-        {
-            // copy memory from src address to dest address
-            write16(dest_ptr, read16(src_ptr));
+    // disabled again before it got the bus
+    if (dma[n].enable)
+        _dma(n);
+}
 
-            // increment src, dest ptrs
-            src_ptr  += src_inc  * sizeof(u16);
-            dest_ptr += dest_inc * sizeof(u16);
-        }
+// host memory behind a guest address and how many bytes after it are contiguous, null if it isn't plain memory
+// palette RAM and OAM aren't in the page tables, but DMA is how most games fill them
+u8 *Memory::dmaPointer(u32 address, bool write, u32 &length)
+{
+    if (u8 *page = write ? writePage(address) : readPage(address))
+    {
+        length = (PAGE_MASK + 1) - (address & PAGE_MASK);
+        return page + (address & PAGE_MASK);
     }
 
-    // reset initial destination address if required
-    if (dma[2].dest_adjust == 3)
-        dest_ptr = original_dest;
-
-    // write back dest
-    write32Unsafe(REG_DMA2DAD, dest_ptr);
-
-    // write back src
-    write32Unsafe(REG_DMA2SAD, src_ptr);
-
+    switch (address >> 24)
+    {
+        // Palette RAM
+        case 0x5:
+            length = MEM_PALETTE_RAM_SIZE - (address & (MEM_PALETTE_RAM_SIZE - 1));
+            return backing(address);
 
-    // turn off this transfer if repeat bit is not set
-    if (dma[2].repeat == 0)
-        dma[2].enable = 0;
+        // OAM
+        case 0x7:
+            length = MEM_OAM_SIZE - (address & (MEM_OAM_SIZE - 1));
+            return backing(address);
 
-    // IRQ request
-    if (dma[2].irq)
-    {
-        log(LogLevel::Debug, "DMA2 IRQ request\n");
-        irq->raise(InterruptOccasion::DMA2);
+        default:
+            return nullptr;
     }
-
-    //log(LogLevel::Debug, "DMA 2 Done\n");
 }
 
-void Memory::dma3()
+// copy, or fill from a fixed source, as many units as fit in plain memory on both ends
+// returns the number of units transferred, 0 if either end needs the slow path
+u32 Memory::dmaBulk(u32 src_addr, u32 dest_addr, u32 size, bool src_inc, u32 count)
 {
-    //std::cout << "DMA 3\n";
-    u32 dest_ptr, src_ptr, original_src, original_dest;
-    src_ptr  = original_src  = read32Unsafe(REG_DMA3SAD) & 0xFFFFFFF; // 28 bit
-    dest_ptr = original_dest = read32Unsafe(REG_DMA3DAD) & 0xFFFFFFF; // 28 bit;
+    u32 src_length, dest_length;
 
-    // increment for destination, src
-    int dest_inc, src_inc;
+    u8 *src  = dmaPointer(src_addr,  false, src_length);
+    u8 *dest = dmaPointer(dest_addr, true,  dest_length);
 
+    if (!src || !dest)
+        return 0;
 
-    // log(LogLevel::Debug, "DMA 3 start addr: 0x{x}\n", (int) src_ptr);
-    // log(LogLevel::Debug, "DMA 3 dest  addr: 0x{x}\n", (int) dest_ptr);
-    // log(LogLevel::Debug, "DMA 3 num transfers: {}\n", dma[3].num_transfers);
+    u32 units = std::min(count, dest_length / size);
 
-    // get increment mode for destination
-    switch (dma[3].dest_adjust)
+    if (src_inc)
     {
-        case 0: dest_inc =  1; break;  // increment after each copy
-        case 1: dest_inc = -1; break;  // decrement after each copy
-        case 2: dest_inc =  0; break;  // leave unchanged
-        case 3: dest_inc =  1; break;  // increment after each copy, reset after transfer
-        default: // should never happen
-            log(LogLevel::Error, "Error: Illegal option for DMA 3 dest adjust: {}\n", (int) dma[3].dest_adjust);
-            break;
-    }
-
-    // get increment mode for src
-    switch (dma[3].src_adjust)
-    {
-        case 0: src_inc =  1; break; // increment after each copy
-        case 1: src_inc = -1; break; // decrement after each copy
-        case 2: src_inc =  0; break; // leave unchanged
-        default: // should never happen
-            log(LogLevel::Error, "Error: Illegal option for DMA 3 src adjust: {}\n", (int) dma[3].src_adjust);
-            break;
-    }
+        units = std::min(units, src_length / size);
 
-    // 32 bit copy
-    if (dma[3].chunk_size == 1)
-    {
-        src_ptr  &= ~0x3; original_src  = src_ptr;
-        dest_ptr &= ~0x3; original_dest = dest_ptr;
-        for (int i = 0; i < dma[3].num_transfers; ++i)
-        {
-            // copy memory from src address to dest address
-            write32(dest_ptr, read32(src_ptr));
+        // a unit by unit copy forward into overlapping memory repeats the start of the source
+        if (dest > src && dest < src + units * size)
+            units = (dest - src) / size;
 
-            // increment src, dest ptrs
-            src_ptr  += src_inc  * sizeof(u32);
-            dest_ptr += dest_inc * sizeof(u32);
-        }
+        // with the destination below the source it reads each unit before overwriting it, as memmove does
+        memmove(dest, src, units * size);
     }
 
-    // 16 bit copy
     else
     {
-        src_ptr  &= ~0x1; original_src  = src_ptr;
-        dest_ptr &= ~0x1; original_dest = dest_ptr;
+        u8 value[sizeof(u32)];
+        memcpy(value, src, size);
 
-        for (int i = 0; i < dma[3].num_transfers; ++i)
-        {
-            // copy memory from src address to dest address
-            write16(dest_ptr, read16(src_ptr));
-
-            // increment src, dest ptrs
-            src_ptr  += src_inc  * sizeof(u16);
-            dest_ptr += dest_inc * sizeof(u16);
-        }
+        for (u32 i = 0; i < units; ++i)
+            memcpy(dest + i * size, value, size);
     }
 
-    // reset initial destination address if required
-    if (dma[3].dest_adjust == 3)
-        dest_ptr = original_dest;
+    if ((dest_addr >> 24) == 0x7)
+        stat->oam_changed = true;
 
-    // write back dest
-    write32Unsafe(REG_DMA3DAD, dest_ptr);
+    invalidate(dest_addr, units * size);
 
-    // write back src
-    write32Unsafe(REG_DMA3SAD, src_ptr);
-
-
-    // turn off this transfer if repeat bit is not set
-    if (dma[3].repeat == 0)
-        dma[3].enable = 0;
-
-    // IRQ request
-    if (dma[3].irq)
-    {
-        log(LogLevel::Debug, "DMA3 IRQ request\n");
-        irq->raise(InterruptOccasion::DMA3);
-    }
-        
-    //log(LogLevel::Debug, "DMA 3 Done\n");
+    return units;
 }
 
 Memory::Region Memory::getMemoryRegion(u32 address)
@@ -7,6 +7,7 @@
  * DATE: January 6th, 2021
  * DESCRIPTION: Implementation of PPU class
  */
+#include <algorithm>
 #include <cstring>
 #include <functional>
 
@@ -16,18 +17,16 @@
 
 extern IRQ *irq;
 
-// transparent pixel color
-constexpr int TRANSPARENT = 0x8000;
-
 PPU::PPU(Memory *mem, LcdStat *stat, Scheduler *scheduler) :
     mem(mem),
     stat(stat),
-    scheduler(scheduler)
+    scheduler(scheduler),
+    tile_cache(mem)
 {
     // internal ptrs linked to memory's
-    palram = &mem->memory[MEM_PALETTE_RAM_START];
-    vram   = &mem->memory[MEM_VRAM_START];
-    oam    = &mem->memory[MEM_OAM_START];
+    palram = mem->palram;
+    vram   = mem->vram;
+    oam    = mem->oam;
 
     //original_screen->pixels = (u32 *) screen_buffer;
 
@@ -47,17 +46,39 @@ PPU::PPU(Memory *mem, LcdStat *stat, Scheduler *scheduler) :
         color_lut[i] = r << 16 | g << 8 |  b;
     }
 
-    // Schedule the first hdraw and vdraw
-    //scheduler->add(HDRAW_CYCLES, std::bind(&PPU::hblank, this));
-    //scheduler->add(VDRAW_CYCLES, std::bind(&PPU::vblank, this));
+    // widest compositor the host can run
+    composite = &PPU::compositeScalar;
+
+    #if defined(__x86_64__)
+    if (__builtin_cpu_supports("avx2"))
+        composite = &PPU::compositeAVX2;
+
+    else if (__builtin_cpu_supports("sse4.1"))
+        composite = &PPU::compositeSSE41;
+    #endif
 
     reset();
+
+    // schedule the end of the first hdraw
+    // events fire once the scheduler passes their timestamp, so the hblank starts on cycle 960
+    next_event = scheduler->cycles + HDRAW_CYCLES - 1;
+    scheduler->addAt(next_event, EventType::HDRAW_END, &PPU::onHdrawEnd, this);
 }
 
 void PPU::reset()
 {
-    cycles   = 0;
     scanline = 0;
+
+    obj_color.fill(TRANSPARENT);
+    obj_priority.fill(4);
+    memset(objwin_scanline_buffer, 0, sizeof(objwin_scanline_buffer));
+
+    // nothing is drawn until OAM is written
+    for (int line = 0; line < SCREEN_HEIGHT; ++line)
+        obj_bins[line].count = 0;
+
+    bins_hblank_free = false;
+
     frame    = 0;
     fps      = 0;
     old_time = clock();
@@ -76,103 +97,115 @@ void PPU::reset()
         bg_buffer[i].fill(TRANSPARENT);
 }
 
-void PPU::tick()
+// start HBlank
+void PPU::hdrawEnd()
 {
-    cycles++;
-
-    // start HBlank
-    if (cycles == 960)
+    if (scanline < SCREEN_HEIGHT)
     {
-        if (scanline < SCREEN_HEIGHT)
-            renderScanline();
+        renderScanline();
 
-        stat->dispstat.in_hBlank = true;
-
-        // fire HBlank interrupt if necessary
-        if (stat->dispstat.hbi)
+        // affine reference points move to the next line, whether or not the bg is shown
+        for (int bg = 2; bg < NUM_BG; ++bg)
         {
-            irq->raise(InterruptOccasion::HBLANK);
-            //LOG(LogLevel::Debug, "HBlank interrupt\n");
-        }
+            u32 matrix = bg == 2 ? REG_BG2PA : REG_BG3PA;
 
-        // check for DMA HBlank requests
-        // TODO - Don't fire DMA Hblank in VBlank
-        if (!stat->dispstat.in_vBlank)
-        {
-            for (int i = 0; i < 4; ++i)
-            {
-                if (mem->dma[i].enable && mem->dma[i].mode == 2) // start at HBLANK
-                {
-                    mem->_dma(i);
-                    //LOG(LogLevel::Debug, "DMA {} HBLANK\n", i);
-                }
-            }
+            stat->bgcnt[bg].ref_x += (s16) mem->read16Unsafe(matrix + 2); // pb
+            stat->bgcnt[bg].ref_y += (s16) mem->read16Unsafe(matrix + 6); // pd
         }
+    }
 
-        // start VBlank
-        if (scanline == 160)
-        {
-            render();
-            stat->dispstat.in_vBlank = true;
+    stat->dispstat.in_hBlank = true;
 
-            // fire Vblank interrupt if necessary
-            if (stat->dispstat.vbi)
-            {
-                irq->raise(InterruptOccasion::VBLANK);
-                //LOG(LogLevel::Debug, "VBlank interrupt\n");
-            }
+    // fire HBlank interrupt if necessary
+    if (stat->dispstat.hbi)
+    {
+        irq->raise(InterruptOccasion::HBLANK);
+        //LOG(LogLevel::Debug, "HBlank interrupt\n");
+    }
 
-            // check for DMA VBLANK requests
-            for (int i = 0; i < 4; ++i)
-            {
-                if (mem->dma[i].enable && mem->dma[i].mode == 1) // start at VBLANK
-                {
-                    mem->_dma(i);
-                    log(LogLevel::Debug, "DMA {} VBLANK\n", i);
-                }
-            }
-        }
+    // DMA HBlank requests, none in VBlank
+    if (!stat->dispstat.in_vBlank)
+        mem->triggerDma(DmaTiming::HBLANK);
+
+    // DMA 3 video capture, for lines 2 - 161
+    if (scanline >= 2 && scanline < 162)
+        mem->triggerDma(DmaTiming::SPECIAL, 1 << 3);
+
+    if (scanline == 160)
+        vblankStart();
+
+    next_event += HBLANK_CYCLES;
+    scheduler->addAt(next_event, EventType::HBLANK_END, &PPU::onHblankEnd, this);
+}
+
+// completed HBlank
+void PPU::hblankEnd()
+{
+    // completed full refresh
+    if (scanline == 160 + 68)
+    {
+        stat->dispstat.in_vBlank = false;
+        scanline = 0;
+        stat->scanline = 0;
     }
 
-    // completed HBlank
-    else if (cycles == 960 + 272)
+    else
     {
-        // completed full refresh
-        if (scanline == 160 + 68)
-        {
-            stat->dispstat.in_vBlank = false;
-            scanline = 0;
-            stat->scanline = 0;
-        }
+        scanline++;
+        stat->scanline++;
+    }
 
-        else
-        {
-            scanline++;
-            stat->scanline++;
-        }
+    vcountMatch();
 
-        // scanline has reached trigger value
-        if (scanline == stat->dispstat.vct)
-        {
-            // set trigger status
-            stat->dispstat.vcs = 1;
+    stat->dispstat.in_hBlank = false;
 
-            // scanline interrupt is triggered if requested
-            if (stat->dispstat.vci)
-            {
-                irq->raise(InterruptOccasion::VCOUNT);
-                // std::cout << "Scanline interrupt\n";
-            }
+    next_event += HDRAW_CYCLES;
+    scheduler->addAt(next_event, EventType::HDRAW_END, &PPU::onHdrawEnd, this);
+}
 
-        }
+void PPU::vblankStart()
+{
+    render();
+    stat->dispstat.in_vBlank = true;
 
-        // scanline is not equal to trigger value, reset this bit
-        else
-            stat->dispstat.vcs = 0;
+    // affine reference points go back to BGxX, BGxY for the next frame
+    for (int bg = 2; bg < NUM_BG; ++bg)
+    {
+        stat->bgcnt[bg].ref_x = (s32) (stat->bgcnt[bg].dx << 4) >> 4;
+        stat->bgcnt[bg].ref_y = (s32) (stat->bgcnt[bg].dy << 4) >> 4;
+    }
 
-        cycles = 0;
-        stat->dispstat.in_hBlank = false;
+    // fire Vblank interrupt if necessary
+    if (stat->dispstat.vbi)
+    {
+        irq->raise(InterruptOccasion::VBLANK);
+        //LOG(LogLevel::Debug, "VBlank interrupt\n");
     }
+
+    // DMA VBlank requests
+    mem->triggerDma(DmaTiming::VBLANK);
+}
+
+void PPU::vcountMatch()
+{
+    // scanline has reached trigger value
+    if (scanline == stat->dispstat.vct)
+    {
+        // set trigger status
+        stat->dispstat.vcs = 1;
+
+        // scanline interrupt is triggered if requested
+        if (stat->dispstat.vci)
+        {
+            irq->raise(InterruptOccasion::VCOUNT);
+            // std::cout << "Scanline interrupt\n";
+        }
+
+    }
+
+    // scanline is not equal to trigger value, reset this bit
+    else
+        stat->dispstat.vcs = 0;
 }
 
 void PPU::render()
@@ -187,6 +220,9 @@ void PPU::renderScanline()
     // index 0 in BG palette
     u16 backdrop_color = palram[1] << 8 | palram[0];
 
+    // forget tiles whose VRAM changed since the last scanline
+    tile_cache.sync();
+
     // prepare enabled backgrounds to be rendered
     for (int priority = 3; priority >= 0; --priority)
     {
@@ -242,65 +278,18 @@ void PPU::renderScanline()
         renderScanlineObj();
     }
 
-    bool window = stat->dispcnt.win_enabled;
-    int active_window, *active_window_content;
-
-    for (int x = 0; x < SCREEN_WIDTH; ++x)
-    {
-        u16 pixel = backdrop_color;
+    buildLayerMask();
 
-        int priority = 4;
+    u16 line[SCREEN_WIDTH];
+    (this->*composite)(line, backdrop_color);
 
-        // This window composition logic was modified from NanoBoyAdvance.
-        // https://github.com/fleroviux/NanoBoyAdvance
-        if (window)
-        {   
-            // Win0 is enabled and the current point is inside it
-            if ((stat->dispcnt.win_enabled & 1) && isInWindow(0, x, scanline))
-                active_window = CONTENT_WIN0;
-
-            // Win1 is enabled and the current point is inside it
-            else if ((stat->dispcnt.win_enabled & 2) && isInWindow(1, x, scanline))
-                active_window = CONTENT_WIN1;
-
-            // Obj window is enabled and the current point is inside it
-            else if ((stat->dispcnt.win_enabled & 4) && objwin_scanline_buffer[x])
-                active_window = CONTENT_WINOBJ;
-
-            // Current point is in winout
-            else
-                active_window = CONTENT_WINOUT;
-
-            active_window_content = stat->window_content[active_window];
-            
-            //log("{} {} {} {}\n", x, scanline, isInWindow(1, x, scanline), debug);
-            //log("stats = {} {} {} {}\n", stat->winh[1].left, stat->winh[1].right, stat->winv[1].top, stat->winv[1].bottom);
-        }
-
-        bool obj_in_current_window = window ? active_window_content[4] : true;
-
-        for (int i = 0; i < bg_list.size(); i++)
-        {
-            int bg = bg_list[i];
-            bool bg_in_current_window = window ? active_window_content[bg] : true;
-
-            if (bg_in_current_window && (bg_buffer[bg][x] != TRANSPARENT))
-            {
-                pixel = bg_buffer[bg][x];
-                priority = stat->bgcnt[bg].priority;
-            }
-        }
-
-        if (obj_in_current_window && (obj_scanline_buffer[x].priority <= priority) && (obj_scanline_buffer[x].color != TRANSPARENT))
-            pixel = obj_scanline_buffer[x].color;
-
-        screen_buffer[scanline][x] = u16ToU32Color(pixel);
+    for (int x = 0; x < SCREEN_WIDTH; ++x)
+        screen_buffer[scanline][x] = u16ToU32Color(line[x]);
 
-        // zero oam buffers for next scanline
-        objwin_scanline_buffer[x] = 0;
-        obj_scanline_buffer[x].color = TRANSPARENT;
-        obj_scanline_buffer[x].priority = 4;
-    }
+    // zero oam buffers for next scanline
+    obj_color.fill(TRANSPARENT);
+    obj_priority.fill(4);
+    memset(objwin_scanline_buffer, 0, sizeof(objwin_scanline_buffer));
 
     bg_list.clear();
 }
@@ -324,24 +313,25 @@ void PPU::renderScanlineText(int bg)
     }
 
     // map position
-    int map_x, map_y = (scanline + bgcnt.voff) % height;
+    int map_x = bgcnt.hoff % width;
+    int map_y = (scanline + bgcnt.voff) % height;
 
     // tile coordinates (in map)
     int tile_x, tile_y = map_y / 8; // 8 px per tile
 
     int screenblock, screenentry, se_index;
     int tile_id, hflip, vflip, palbank; // screenentry properties
-    int pixel;
     u32 tile_addr;
 
     // used for vflip / hflip
     int grid_x, grid_y;
 
-    // conver only where bg is inside its window
-    for (int x = 0; x < SCREEN_WIDTH; ++x)
+    // walk the line a tile at a time, the first and last tiles are cut short by the scroll
+    for (int x = 0; x < SCREEN_WIDTH; )
     {
-        map_x = (x + bgcnt.hoff) % width;
-        tile_x = map_x / 8; // 8 px per tile
+        tile_x = map_x / 8;
+        grid_x = map_x % 8;
+        grid_y = map_y % 8;
 
         screenblock = bgcnt.sbb + ((tile_y / 32) * pitch + (tile_x / 32));
         se_index = screenblock * 1024 + (tile_y % 32) * 32 + (tile_x % 32);
@@ -351,30 +341,42 @@ void PPU::renderScanlineText(int bg)
         hflip   = screenentry >> 10 & 0x1;
         vflip   = screenentry >> 11 & 0x1;
 
-        grid_x = map_x % 8;
-        grid_y = map_y % 8;
-
-        if (hflip)
-            grid_x = 7 - grid_x;
-
+        // hflip picks the mirrored copy of the tile
         if (vflip)
             grid_y = 7 - grid_y;
 
+        // pixels of this tile left on the line
+        int span = std::min(8 - grid_x, SCREEN_WIDTH - x);
+        u16 *out = &bg_buffer[bg][x];
+
         if (bgcnt.color_mode == 0) // 4BPP
         {
             palbank = screenentry >> 12 & 0xF;
 
             tile_addr = bgcnt.cbb * CHARBLOCK_LEN + 0x20 * tile_id;
-            pixel = getBGPixel4BPP(tile_addr, palbank, grid_x, grid_y);
+            u8 const *row = tile_cache.tile4(tile_addr, hflip) + grid_y * 8 + grid_x;
+
+            for (int i = 0; i < span; ++i)
+            {
+                int idx = row[i] * 2 + palbank * PALBANK_LEN;
+                out[i] = row[i] ? palram[idx + 1] << 8 | palram[idx] : TRANSPARENT;
+            }
         }
 
         else // 8BPP
         {
             tile_addr = bgcnt.cbb * CHARBLOCK_LEN + 0x40 * tile_id;
-            pixel = getBGPixel8BPP(tile_addr, grid_x, grid_y);
+            u8 const *row = tile_cache.tile8(tile_addr, hflip) + grid_y * 8 + grid_x;
+
+            for (int i = 0; i < span; ++i)
+            {
+                int idx = row[i] * 2;
+                out[i] = row[i] ? palram[idx + 1] << 8 | palram[idx] : TRANSPARENT;
+            }
         }
 
-        bg_buffer[bg][x] = pixel;
+        x += span;
+        map_x = (map_x + span) % width;
     }
 }
 
@@ -383,7 +385,6 @@ void PPU::renderScanlineAffine(int bg)
 {
     auto const &bgcnt = stat->bgcnt[bg];
 
-    // displacement vector
     // width, height of map in pixels
     int width, height;
     switch (bgcnt.size)
@@ -394,37 +395,19 @@ void PPU::renderScanlineAffine(int bg)
         case 0b11: width = height = 1024; break;
     }
 
-    int dx_raw = bgcnt.dx;
-    int dy_raw = bgcnt.dy;
-    float dx, dy; // displacement vector
-    float pa, pb, pc, pd; // P matrix
-    switch (bg)
-    {
-        case 2:
-            pa = (s16) mem->read32Unsafe(REG_BG2PA) / 256.0;
-            pb = (s16) mem->read32Unsafe(REG_BG2PB) / 256.0;
-            pc = (s16) mem->read32Unsafe(REG_BG2PC) / 256.0;
-            pd = (s16) mem->read32Unsafe(REG_BG2PD) / 256.0;
-            break;
-
-        case 3:
-            pa = (s16) mem->read32Unsafe(REG_BG3PA) / 256.0;
-            pb = (s16) mem->read32Unsafe(REG_BG3PB) / 256.0;
-            pc = (s16) mem->read32Unsafe(REG_BG3PC) / 256.0;
-            pd = (s16) mem->read32Unsafe(REG_BG3PD) / 256.0;
-            break;
-    }
+    // P matrix, 8.8 fixed point
+    // pb and pd move the reference point between lines, see hdrawEnd
+    u32 matrix = bg == 2 ? REG_BG2PA : REG_BG3PA;
+    s16 pa = mem->read16Unsafe(matrix);
+    s16 pc = mem->read16Unsafe(matrix + 4);
 
-    dx = (float) (dx_raw >> 8) + ((dx_raw & 0xFF) / 256.0f);
-    dy = (float) (dy_raw >> 8) + ((dx_raw & 0xFF) / 256.0f);
+    // texture coordinate of the current pixel, 20.8 fixed point, stepped by pa, pc every pixel
+    s32 tx = bgcnt.ref_x;
+    s32 ty = bgcnt.ref_y;
 
-    //dx += pb * scanline;
-    //dy += pd * scanline;
+    // maps are square and a power of 2 wide, so wrapping is a mask
+    int mask = width - 1;
 
-    float x0 = dx, y0 = dy;
-    int   x1,      y1 = scanline + dy;
-    int   px,      py;
-    
     // map position
     int map_x, map_y;
 
@@ -435,39 +418,25 @@ void PPU::renderScanlineAffine(int bg)
     int pixel;
     u32 tile_addr;
 
-    for (int x = 0; x < SCREEN_WIDTH; ++x)
+    for (int x = 0; x < SCREEN_WIDTH; ++x, tx += pa, ty += pc)
     {
-        x1 = x + dx;
-
-        // affine transform
-        px = pa * (x1 - x0) + pb * (y1 - y0) + x0;
-        py = pc * (x1 - x0) + pd * (y1 - y0) + y0;
+        map_x = tx >> 8;
+        map_y = ty >> 8;
 
         // wrap
         if (bgcnt.affine_wrap == 1)
         {
-            px %= width;
-            py %= height;
-
-            if (px < 0)
-                px = width  - std::abs(px);
-            if (py < 0)
-                py = height - std::abs(py);
+            map_x &= mask;
+            map_y &= mask;
         }
 
-        // no wrap
-        else
+        // transformed coordinate is out of bounds
+        else if ((u32) map_x >= (u32) width || (u32) map_y >= (u32) height)
         {
-            // transformmed coordinate is out of bounds
-            if (px >= width || py >= height || px < 0 || py < 0)
-            {
-                bg_buffer[bg][x] = TRANSPARENT;
-                continue;
-            }       
+            bg_buffer[bg][x] = TRANSPARENT;
+            continue;
         }
 
-        map_x = px;
-        map_y = py;
         tile_x = map_x / 8; // 8 px per tile
         tile_y = map_y / 8;
 
@@ -475,7 +444,7 @@ void PPU::renderScanlineAffine(int bg)
         tile_addr = bgcnt.cbb * CHARBLOCK_LEN + se_index * 0x40;
 
         // 8BPP only
-        pixel = getBGPixel8BPP(tile_addr, map_x % 8, map_y % 8);
+        pixel = getBGPixel8BPP(tile_addr, map_x % 8, map_y % 8, false);
 
         bg_buffer[bg][x] = pixel;
     }
@@ -544,41 +513,36 @@ void PPU::renderScanlineBitmap(int mode)
 
 void PPU::renderScanlineObj()
 {
-    u16 pixel;
+    auto const &bin = obj_bins[scanline];
 
-    for (int i = NUM_OBJS - 1; i >= 0; --i)
+    // lower OAM indices are drawn last so they win ties in priority
+    for (int n = bin.count - 1; n >= 0; --n)
     {
-        auto const &attr = objs[i];
-
-        // skip hidden object
-        if (attr.obj_mode == 2)
-            continue;
+        auto const &attr = objs[bin.index[n]];
 
-        // obj exists outside current scanline
-        if (scanline < attr.qy0 - attr.hheight || scanline >= attr.qy0 + attr.hheight)
-            continue;
-        
         int qx0 = attr.qx0; // center of sprite screen space
 
         // x, y coordinate of texture after transformation
         int px, py;
         int iy = -attr.hheight + (scanline - attr.y);
 
+        // texture coordinate of the current pixel, 8.8 fixed point, stepped by pa, pc every pixel
+        // regular objs go through the identity matrix
+        bool affine = attr.obj_mode == 1 || attr.obj_mode == 3;
+
+        s32 pa = affine ? attr.pa : 1 << 8;
+        s32 pc = affine ? attr.pc : 0;
+        s32 tx = affine ? attr.pa * -attr.hwidth + attr.pb * iy + (attr.px0 << 8) : 0;
+        s32 ty = affine ? attr.pc * -attr.hwidth + attr.pd * iy + (attr.py0 << 8) : (iy + attr.hheight) << 8;
+
 
         //log("{} {} {} {}\n", attr.x, attr.y, attr.hheight, attr.hwidth);
         //log("{} {} {} {}\n", attr.x0, attr.y0, attr.hheight, attr.hwidth);
 
-        for (int ix = -attr.hwidth; ix < attr.hwidth; ++ix)
+        for (int ix = -attr.hwidth; ix < attr.hwidth; ++ix, tx += pa, ty += pc)
         {
-            px = ix + attr.hwidth;
-            py = iy + attr.hheight;
-
-            // transform affine & double wide affine
-            if (attr.obj_mode == 1 || attr.obj_mode == 3)
-            {
-                px = attr.pa * ix + attr.pb * iy + attr.px0;
-                py = attr.pc * ix + attr.pd * iy + attr.py0;
-            }
+            px = tx >> 8;
+            py = ty >> 8;
 
             // horizontal / vertical flip
             if (attr.h_flip) px = attr.width  - px - 1;
@@ -636,10 +600,10 @@ void PPU::renderScanlineObj()
                 if (attr.gfx_mode == 2)
                     objwin_scanline_buffer[qx0 + ix] = 1;
                 
-                else if (attr.priority <= obj_scanline_buffer[qx0 + ix].priority)
+                else if (attr.priority <= obj_priority[qx0 + ix])
                 {
-                    obj_scanline_buffer[qx0 + ix].color = pixel;
-                    obj_scanline_buffer[qx0 + ix].priority = attr.priority;
+                    obj_color[qx0 + ix] = pixel;
+                    obj_priority[qx0 + ix] = attr.priority;
                 }
             }
         }
@@ -649,7 +613,8 @@ void PPU::renderScanlineObj()
 void PPU::updateAttr()
 {
     // no need to refresh oam data structure if no changes have been made
-    if (!stat->oam_changed)
+    // the bins also depend on the hblank interval free bit
+    if (!stat->oam_changed && stat->dispcnt.hb == bins_hblank_free)
         return;
 
     int attr_ptr = 0;
@@ -735,13 +700,13 @@ void PPU::updateAttr()
         {
             u32 matrix_ptr = obj.affine_index * 32; // each affine entry is 32 bytes across
 
-            // transform P matrix from 8.8f to float
+            // P matrix, 8.8 fixed point
             // P = [pa pb]
             //     [pc pd]
-            obj.pa = (s16) (oam[matrix_ptr +  0x6 + 1] << 8 | oam[matrix_ptr +  0x6]) / 256.0;
-            obj.pb = (s16) (oam[matrix_ptr +  0xE + 1] << 8 | oam[matrix_ptr +  0xE]) / 256.0;
-            obj.pc = (s16) (oam[matrix_ptr + 0x16 + 1] << 8 | oam[matrix_ptr + 0x16]) / 256.0;
-            obj.pd = (s16) (oam[matrix_ptr + 0x1E + 1] << 8 | oam[matrix_ptr + 0x1E]) / 256.0;
+            obj.pa = oam[matrix_ptr +  0x6 + 1] << 8 | oam[matrix_ptr +  0x6];
+            obj.pb = oam[matrix_ptr +  0xE + 1] << 8 | oam[matrix_ptr +  0xE];
+            obj.pc = oam[matrix_ptr + 0x16 + 1] << 8 | oam[matrix_ptr + 0x16];
+            obj.pd = oam[matrix_ptr + 0x1E + 1] << 8 | oam[matrix_ptr + 0x1E];
 
             // double wide affine
             if (obj.obj_mode == 3)
@@ -757,23 +722,57 @@ void PPU::updateAttr()
             obj.v_flip = 0;
             obj.h_flip = 0;
         }
-
-        stat->oam_changed = false;
     }
+
+    binObjs();
+    stat->oam_changed = false;
 }
 
-inline u16 PPU::getObjPixel4BPP(u32 addr, int palbank, int x, int y)
+// list the objs drawn on each scanline, in OAM order
+// the hardware goes through OAM until it runs out of cycles for the line, the objs after that aren't drawn
+void PPU::binObjs()
 {
-    addr += (y * 4) + (x / 2);
+    bins_hblank_free = stat->dispcnt.hb;
 
-    // add 0x10000 for lower sprite block
-    u8 palette_index = vram[addr + 0x10000];
+    int budget = bins_hblank_free ? OBJ_CYCLES_HBLANK_FREE : OBJ_CYCLES;
+    int cycles[SCREEN_HEIGHT] = {};
 
-    // use top nybble for odd x, even otherwise
-    if (x & 1)
-        palette_index >>= 4;
+    for (int line = 0; line < SCREEN_HEIGHT; ++line)
+        obj_bins[line].count = 0;
 
-    palette_index &= 0xF;
+    for (int i = 0; i < NUM_OBJS; ++i)
+    {
+        auto const &attr = objs[i];
+
+        if (attr.obj_mode == 2)
+            continue;
+
+        // affine objs take 2 cycles per pixel of their bounds plus 10 to set up
+        int cost = attr.obj_mode == 0 ? attr.width : 10 + 4 * attr.hwidth;
+
+        int top    = std::max(attr.qy0 - attr.hheight, 0);
+        int bottom = std::min(attr.qy0 + attr.hheight, SCREEN_HEIGHT);
+
+        for (int line = top; line < bottom; ++line)
+        {
+            if (cycles[line] + cost > budget)
+            {
+                cycles[line] = budget;
+                continue;
+            }
+
+            cycles[line] += cost;
+
+            auto &bin = obj_bins[line];
+            bin.index[bin.count++] = i;
+        }
+    }
+}
+
+inline u16 PPU::getObjPixel4BPP(u32 addr, int palbank, int x, int y)
+{
+    // add 0x10000 for lower sprite block
+    u8 palette_index = tile_cache.tile4(addr + 0x10000, false)[y * 8 + x];
 
     if (palette_index == 0)
         return TRANSPARENT;
@@ -786,10 +785,8 @@ inline u16 PPU::getObjPixel4BPP(u32 addr, int palbank, int x, int y)
 
 inline u16 PPU::getObjPixel8BPP(u32 addr, int x, int y)
 {
-    addr += y * 8 + x;
-
     // add 0x10000 for lower sprite block
-    u8 palette_index = vram[addr + 0x10000];
+    u8 palette_index = tile_cache.tile8(addr + 0x10000, false)[y * 8 + x];
 
    if (palette_index == 0)
         return TRANSPARENT;
@@ -799,31 +796,9 @@ inline u16 PPU::getObjPixel8BPP(u32 addr, int x, int y)
     return palram[idx + 1] << 8 | palram[idx];
 }
 
-inline u16 PPU::getBGPixel4BPP(u32 addr, int palbank, int x, int y)
-{
-    addr += (y * 4) + (x / 2);
-
-    u8 palette_index = vram[addr];
-
-    // use top nybble for odd x, even otherwise
-    if (x & 1)
-        palette_index >>= 4;
-
-    palette_index &= 0xF;
-
-    if (palette_index == 0)
-        return TRANSPARENT;
-    
-    int idx = palette_index * 2 + palbank * PALBANK_LEN;
-
-    return palram[idx + 1] << 8 | palram[idx];
-}
-
-inline u16 PPU::getBGPixel8BPP(u32 addr, int x, int y)
+inline u16 PPU::getBGPixel8BPP(u32 addr, int x, int y, bool hflip)
 {
-    addr += (y * 8) + x;
-
-    u8 palette_index = vram[addr];
+    u8 palette_index = tile_cache.tile8(addr, hflip)[y * 8 + x];
 
     if (palette_index == 0)
        return TRANSPARENT;
@@ -833,9 +808,4 @@ inline u16 PPU::getBGPixel8BPP(u32 addr, int x, int y)
     return palram[idx + 1] << 8 | palram[idx];
 }
 
-inline bool PPU::isInWindow(int win, int x, int y)
-{
-    return (x >= stat->winh[win].left) && (x < stat->winh[win].right) && (y >= stat->winv[win].top) && (y < stat->winv[win].bottom);
-}
-
 inline u32 PPU::u16ToU32Color(u16 color_u16) { return color_lut[color_u16 & 0x7FFF]; }
@@ -1,37 +1,133 @@
 #include "Scheduler.h"
 #include "log.h"
 #include <cassert>
-#include <vector>
+#include <algorithm>
 
-void Scheduler::add(int until, std::function<void(void)> handler, int id)
+Scheduler::Scheduler()
 {
-    auto iter = events.begin();
-    while (iter != events.end() && (iter->timestamp < cycles + until))
-        iter++;
-    
-    events.insert(iter, { cycles + until, handler, id });
+    cycles     = 0;
+    size       = 0;
+    next_order = 0;
+    pos.fill(-1);
+}
+
+void Scheduler::add(int until, EventType type, Handler handler, void *ctx)
+{
+    addAt(cycles + until, type, handler, ctx);
+}
+
+// schedule an event at an absolute timestamp, so periodic events don't drift when fired late
+void Scheduler::addAt(u64 timestamp, EventType type, Handler handler, void *ctx)
+{
+    int id = static_cast<int>(type);
+
+    if (pos[id] != -1)
+        erase(pos[id]);
+
+    events[id] = { timestamp, next_order++, handler, ctx };
+
+    heap[size] = id;
+    pos[id]    = size;
+    siftUp(size++);
 }
 
 void Scheduler::advance(int amount)
 {
-    cycles += amount;   
-    while (!events.empty() && events.front().timestamp < cycles)
+    cycles += amount;
+    while (size > 0 && events[heap[0]].timestamp < cycles)
     {
-        auto event = events.front();
-        
-        event.handler();
-        events.pop_front();
+        // pop before firing, the handler may reschedule the same event
+        Event event = events[heap[0]];
+        erase(0);
+
+        event.handler(event.ctx);
     }
 }
 
-void Scheduler::remove(int id)
-{   
-    for (auto iter = events.begin(); iter != events.end(); iter++)
+void Scheduler::remove(EventType type)
+{
+    int id = static_cast<int>(type);
+
+    if (pos[id] != -1)
+        erase(pos[id]);
+}
+
+int Scheduler::cyclesUntilNextEvent()
+{
+    // nothing scheduled, any large budget will do
+    if (size == 0)
+        return 280896;
+
+    // events fire once cycles has passed their timestamp
+    return std::max<s64>(events[heap[0]].timestamp + 1 - cycles, 1);
+}
+
+// true if the event at heap index a should fire before the one at b
+bool Scheduler::before(int a, int b)
+{
+    auto &x = events[heap[a]];
+    auto &y = events[heap[b]];
+
+    if (x.timestamp != y.timestamp)
+        return x.timestamp < y.timestamp;
+
+    return x.order < y.order;
+}
+
+void Scheduler::swap(int a, int b)
+{
+    std::swap(heap[a], heap[b]);
+    pos[heap[a]] = a;
+    pos[heap[b]] = b;
+}
+
+void Scheduler::siftUp(int i)
+{
+    while (i > 0)
+    {
+        int parent = (i - 1) / 2;
+        if (!before(i, parent))
+            break;
+
+        swap(i, parent);
+        i = parent;
+    }
+}
+
+void Scheduler::siftDown(int i)
+{
+    while (true)
     {
-        if (iter->id == id)
-        {
-            events.erase(iter);
+        int smallest = i;
+        int left     = 2 * i + 1;
+        int right    = 2 * i + 2;
+
+        if (left < size && before(left, smallest))
+            smallest = left;
+        if (right < size && before(right, smallest))
+            smallest = right;
+
+        if (smallest == i)
             break;
-        }
+
+        swap(i, smallest);
+        i = smallest;
     }
-}
\ No newline at end of file
+}
+
+// remove the event at heap index i
+void Scheduler::erase(int i)
+{
+    assert(i < size);
+
+    pos[heap[i]] = -1;
+
+    if (i == --size)
+        return;
+
+    heap[i]      = heap[size];
+    pos[heap[i]] = i;
+
+    siftDown(i);
+    siftUp(i);
+}
@@ -0,0 +1,80 @@
+/* discovery
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ *
+ * FILE: TileCache.cpp
+ * DATE: October 16th, 2026
+ * DESCRIPTION: cache of VRAM tiles decoded to one palette index per pixel
+ */
+#include <bit>
+#include <utility>
+
+#include "TileCache.h"
+
+TileCache::TileCache(Memory *mem) :
+    mem(mem)
+{
+    valid4.reset();
+    valid8.reset();
+}
+
+void TileCache::sync()
+{
+    for (int word = 0; word < VRAM_NUM_TILES / 64; ++word)
+    {
+        u64 dirty = std::exchange(mem->vram_dirty[word], 0);
+
+        while (dirty)
+        {
+            u32 tile = word * 64 + std::countr_zero(dirty);
+            dirty &= dirty - 1;
+
+            valid4[tile] = false;
+            valid8[tile] = false;
+
+            // the second half of the 8bpp tile starting one unit earlier
+            if (tile > 0)
+                valid8[tile - 1] = false;
+        }
+    }
+}
+
+void TileCache::decode4(u32 tile)
+{
+    u8 const *src = &mem->vram[tile * VRAM_TILE_SIZE];
+
+    // 4 bytes per row, low nybble is the left pixel
+    for (int i = 0; i < 32; ++i)
+    {
+        int y = i / 4;
+        int x = i % 4 * 2;
+
+        u8 left  = src[i] & 0xF;
+        u8 right = src[i] >> 4;
+
+        decoded4[tile][0][y * 8 + x]     = left;
+        decoded4[tile][0][y * 8 + x + 1] = right;
+        decoded4[tile][1][y * 8 + 7 - x] = left;
+        decoded4[tile][1][y * 8 + 6 - x] = right;
+    }
+
+    valid4[tile] = true;
+}
+
+void TileCache::decode8(u32 tile)
+{
+    u8 const *src = &mem->vram[tile * VRAM_TILE_SIZE];
+
+    // the second half of the last tile would be past the end of VRAM
+    int len = tile + 1 < VRAM_NUM_TILES ? 64 : 32;
+
+    for (int i = 0; i < 64; ++i)
+    {
+        u8 index = i < len ? src[i] : 0;
+
+        decoded8[tile][0][i] = index;
+        decoded8[tile][1][(i & ~7) + 7 - (i & 7)] = index;
+    }
+
+    valid8[tile] = true;
+}
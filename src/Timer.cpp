@@ -25,10 +25,6 @@ Timer::Timer(Scheduler *scheduler) :
         tmr.reload        = 0;
         tmr.cycle_started = 0;
         tmr.prescalar     = 1;
-
-        tmr.onOverflow = [i, this]() {
-            return std::bind(&Timer::overflow, this, i);
-        }();
     }
 }
 
@@ -84,12 +80,12 @@ void Timer::writeCnt(int ch, u16 value)
          * cycles = (0xFFFF - data) * prescalar;
          */
         int cycles_until_overflow = (0xFFFF - tmr.data) * tmr.prescalar;
-        scheduler->add(cycles_until_overflow, tmr.onOverflow, ch);
+        scheduler->add(cycles_until_overflow, overflow_event[ch], overflow_handler[ch], this);
     }
 
     // remove tick event from scheduler
     else
-        scheduler->remove(ch);
+        scheduler->remove(overflow_event[ch]);
 }
 
 void Timer::cascade(int ch)
@@ -134,7 +130,7 @@ void Timer::overflow(int ch)
 
     // add next overflow event to scheduler
     int cycles_until_overflow = (0xFFFF - tmr.data) * tmr.prescalar;
-    scheduler->add(cycles_until_overflow, tmr.onOverflow, ch);
+    scheduler->add(cycles_until_overflow, overflow_event[ch], overflow_handler[ch], this);
 
     // cascade
     cascade(ch);
@@ -20,7 +20,7 @@ void Arm7::branchExchange(u32 instruction)
 
     if (Rn == r15)
     {
-        log(LogLevel::Error, "BranchExchange: Undefined behavior: r15 as operand: 0x{x}\n", registers.r15);
+        log(LogLevel::Error, "BranchExchange: Undefined behavior: r15 as operand: 0x{x}\n", registers.r[15]);
         setMode(Mode::UND);
         exit(0);
         return;
@@ -33,7 +33,7 @@ void Arm7::branchExchange(u32 instruction)
     // swith to THUMB mode if necessary
     if ((branch_address & 1) == 1)
     {
-        registers.r15 -= 1; // continue at Rn - 1 for thumb mode
+        registers.r[15] -= 1; // continue at Rn - 1 for thumb mode
         setState(State::THUMB);
     }
 
@@ -70,6 +70,9 @@ void Arm7::branchLink(u32 instruction)
     new_address = getRegister(r15) + offset;
     setRegister(r15, new_address);
 
+    if (!link)
+        checkIdleLoop(new_address);
+
     // flush pipeline for refill
     pipeline_full = false;
 
@@ -601,10 +604,10 @@ void Arm7::singleDataTransfer(u32 instruction)
         else
             setRegister(Rd, read32(base, true));
 
-        // normal loads instructions take 1S + 1N + 1I
+        // normal loads instructions take 1S + 1N + 1I, the 1N is the data access
         ++s;
         ++i;
-        ++n;
+        tickData(base, !byte, 1, 0);
 
         // LDR PC takes an additional 1S + 1N cycles
         if (Rd == r15)
@@ -630,8 +633,9 @@ void Arm7::singleDataTransfer(u32 instruction)
         else // store one word into memory
             write32(base, value);
 
-        // stores take 2N cycles to execute
-        n = 2;
+        // stores take 2N cycles to execute, one of them is the data access
+        n = 1;
+        tickData(base, !byte, 1, 0);
     }
 
     // offset modification after transfer
@@ -738,6 +742,9 @@ void Arm7::halfwordDataTransfer(u32 instruction)
             return;
     }
 
+    // the 1N data access
+    tickData(base, false, 1, 0);
+
     if (!pre_index)
     {
         if (up)
@@ -759,13 +766,12 @@ void Arm7::halfwordDataTransfer(u32 instruction)
         }
 
         ++s;
-        ++n;
         ++i;
     }
     
     else
     {
-        n = 2;
+        n = 1;
     }
 
     // cycles: LDR: 1S + 1N + 1I. LDR PC: 2S + 2N + 1I. STR: 2N
@@ -811,7 +817,7 @@ void Arm7::blockDataTransfer(u32 instruction)
 
         else // store r15
         {
-            write32(base, registers.r15 + 4);
+            write32(base, registers.r[15] + 4);
         }
 
         // store Rb = Rb +/- 0x40
@@ -848,7 +854,7 @@ void Arm7::blockDataTransfer(u32 instruction)
 
     if (load) // load from memory
     { 
-        ++n;
+        ++s;
         ++i;
         if (Rb_in_Rlist)
             write_back = false;
@@ -871,8 +877,6 @@ void Arm7::blockDataTransfer(u32 instruction)
 
                 if (!pre_index) // post increment
                     base += 4;
-                // +1 S cycles for each word transferred
-                ++s;
             }
         }
 
@@ -894,16 +898,13 @@ void Arm7::blockDataTransfer(u32 instruction)
 
                 if (!pre_index) // post decrement
                     base -= 4;
-                
-                // +1 S cycles for each word transferred
-                ++s;
             }
         }
     }
 
     else // store to memory
     {
-        n = 2; 
+        n = 1;
         if (up) // addresses increment
         {
             for (int i = 0; i < num_registers; ++i)
@@ -919,9 +920,6 @@ void Arm7::blockDataTransfer(u32 instruction)
 
                 if (!pre_index) // post increment
                     base += 4;
-                
-                // +1 S cycles for each word transferred
-                ++s;
             }
         }
 
@@ -940,9 +938,6 @@ void Arm7::blockDataTransfer(u32 instruction)
 
                 if (!pre_index) // post decrement
                     base -= 4;
-                
-                // +1 S cycles for each word transferred
-                ++s;
             }
         }
     }
@@ -972,6 +967,8 @@ void Arm7::blockDataTransfer(u32 instruction)
     // cycles:
     // For normal LDM, nS + 1N + 1I.
     // For LDM PC, (n+1)S+2N+1I. For STM (n-1)S+2N. Where n is the number of words transferred.
+    // the words take 1N + (n-1)S of them, starting from the lowest address
+    tickData(old_base, true, 1, num_registers - 1);
     tick(n, s, i);
 }
 
@@ -1008,8 +1005,9 @@ void Arm7::singleDataSwap(u32 instruction)
         setRegister(Rd, temp);
     }
 
-    // cycles: 1S + 2N + 1I
-    tick(2, 1, 1);
+    // cycles: 1S + 2N + 1I, the 2N are the read and the write
+    tickData(swap_address, !byte, 2, 0);
+    tick(0, 1, 1);
 }
 
 void Arm7::softwareInterruptArm(u32 instruction)
@@ -1027,4 +1025,44 @@ void Arm7::softwareInterruptArm(u32 instruction)
 
     // cycles: 2S + 1N
     tick(1, 2, 0);
-}
\ No newline at end of file
+}
+
+// coprocessor and undefined instructions - nothing to execute on the gba
+void Arm7::undefinedArm(u32 instruction)
+{
+    log(LogLevel::Error, "Cannot execute instruction {:x}, pc {:x}\n", (int) instruction, (int) registers.r[15]);
+    registers.r[15] &= ~0x3;
+}
+
+/*
+ * Build the arm handler table at compile time.
+ * Each entry decodes a representative instruction with bits 27-20 and 7-4 taken from its index.
+ * Bits 19-8 are set so that the BX pattern (0x12FFF1) is recognized; no other format depends on them.
+ */
+const std::array<Arm7::ArmHandler, 4096> Arm7::arm_lut = []() constexpr
+{
+    std::array<ArmHandler, 4096> lut{};
+
+    for (u32 i = 0; i < lut.size(); ++i)
+    {
+        u32 instruction = (i & 0xFF0) << 16 | 0xFFF00 | (i & 0xF) << 4;
+
+        switch (util::getInstructionFormat(instruction))
+        {
+            case ArmInstruction::BEX:  lut[i] = &Arm7::branchExchange;       break;
+            case ArmInstruction::B:    lut[i] = &Arm7::branchLink;           break;
+            case ArmInstruction::DP:   lut[i] = &Arm7::dataProcessing;       break;
+            case ArmInstruction::MUL:  lut[i] = &Arm7::multiply;             break;
+            case ArmInstruction::MULL: lut[i] = &Arm7::multiplyLong;         break;
+            case ArmInstruction::PSR:  lut[i] = &Arm7::psrTransfer;          break;
+            case ArmInstruction::SDT:  lut[i] = &Arm7::singleDataTransfer;   break;
+            case ArmInstruction::HDT:  lut[i] = &Arm7::halfwordDataTransfer; break;
+            case ArmInstruction::BDT:  lut[i] = &Arm7::blockDataTransfer;    break;
+            case ArmInstruction::SWP:  lut[i] = &Arm7::singleDataSwap;       break;
+            case ArmInstruction::INT:  lut[i] = &Arm7::softwareInterruptArm; break;
+            default:                   lut[i] = &Arm7::undefinedArm;         break;
+        }
+    }
+
+    return lut;
+}();
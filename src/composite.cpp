@@ -0,0 +1,170 @@
+/* discovery
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ *
+ * FILE: composite.cpp
+ * DATE: October 16th, 2026
+ * DESCRIPTION: combining the layers of a scanline into its final colors
+ *
+ * The windows are resolved first, into a mask of the layers visible at each pixel. Each bg in
+ * bg_list then covers whatever is below it wherever it is visible and opaque, starting from the
+ * backdrop, and objs go on top of any bg with the same or a lower priority.
+ *
+ * The vector versions do the same thing 8 or 16 pixels at a time, the line is a whole number of both.
+ */
+#include <cstring>
+
+#include "PPU.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// bit of the objs in layer_mask and window_content
+constexpr int LAYER_OBJ = 4;
+
+// the window content registers as layer masks
+static u8 windowLayers(LcdStat *stat, int win)
+{
+    u8 layers = 0;
+
+    for (int i = 0; i <= LAYER_OBJ; ++i)
+        layers |= stat->window_content[win][i] << i;
+
+    return layers;
+}
+
+// This window composition logic was modified from NanoBoyAdvance.
+// https://github.com/fleroviux/NanoBoyAdvance
+void PPU::buildLayerMask()
+{
+    int enabled = stat->dispcnt.win_enabled;
+
+    if (!enabled)
+    {
+        memset(layer_mask, 0x1F, sizeof(layer_mask));
+        return;
+    }
+
+    // outside of every window, then the obj window, win1 and win0 on top of each other
+    memset(layer_mask, windowLayers(stat, CONTENT_WINOUT), sizeof(layer_mask));
+
+    if (enabled & 4)
+    {
+        u8 layers = windowLayers(stat, CONTENT_WINOBJ);
+
+        for (int x = 0; x < SCREEN_WIDTH; ++x)
+            if (objwin_scanline_buffer[x])
+                layer_mask[x] = layers;
+    }
+
+    // writes to WINxH keep right <= 240, a left edge past it leaves the window empty
+    for (int win = 1; win >= 0; --win)
+    {
+        if (!(enabled >> win & 1) || scanline < stat->winv[win].top || scanline >= stat->winv[win].bottom)
+            continue;
+
+        int left  = stat->winh[win].left;
+        int right = stat->winh[win].right;
+
+        if (left < right)
+            memset(&layer_mask[left], windowLayers(stat, win == 0 ? CONTENT_WIN0 : CONTENT_WIN1), right - left);
+    }
+}
+
+void PPU::compositeScalar(u16 *line, u16 backdrop)
+{
+    for (int x = 0; x < SCREEN_WIDTH; ++x)
+    {
+        u16 pixel = backdrop;
+        int priority = 4;
+
+        for (int bg : bg_list)
+        {
+            if ((layer_mask[x] >> bg & 1) && bg_buffer[bg][x] != TRANSPARENT)
+            {
+                pixel = bg_buffer[bg][x];
+                priority = stat->bgcnt[bg].priority;
+            }
+        }
+
+        if ((layer_mask[x] >> LAYER_OBJ & 1) && obj_priority[x] <= priority && obj_color[x] != TRANSPARENT)
+            pixel = obj_color[x];
+
+        line[x] = pixel;
+    }
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.1")))
+void PPU::compositeSSE41(u16 *line, u16 backdrop)
+{
+    __m128i const transparent = _mm_set1_epi16(TRANSPARENT);
+    __m128i const obj_bit     = _mm_set1_epi16(1 << LAYER_OBJ);
+
+    for (int x = 0; x < SCREEN_WIDTH; x += 8)
+    {
+        __m128i mask     = _mm_cvtepu8_epi16(_mm_loadl_epi64((__m128i const *) &layer_mask[x]));
+        __m128i pixel    = _mm_set1_epi16(backdrop);
+        __m128i priority = _mm_set1_epi16(4);
+
+        for (int bg : bg_list)
+        {
+            __m128i color = _mm_loadu_si128((__m128i const *) &bg_buffer[bg][x]);
+            __m128i bit   = _mm_set1_epi16(1 << bg);
+
+            // in the window and opaque
+            __m128i visible = _mm_andnot_si128(_mm_cmpeq_epi16(color, transparent), _mm_cmpeq_epi16(_mm_and_si128(mask, bit), bit));
+
+            pixel    = _mm_blendv_epi8(pixel, color, visible);
+            priority = _mm_blendv_epi8(priority, _mm_set1_epi16(stat->bgcnt[bg].priority), visible);
+        }
+
+        __m128i color = _mm_loadu_si128((__m128i const *) &obj_color[x]);
+        __m128i above = _mm_cmpgt_epi16(_mm_loadu_si128((__m128i const *) &obj_priority[x]), priority);
+
+        // in the window, opaque and not below the bg
+        __m128i visible = _mm_cmpeq_epi16(_mm_and_si128(mask, obj_bit), obj_bit);
+        visible = _mm_andnot_si128(_mm_or_si128(above, _mm_cmpeq_epi16(color, transparent)), visible);
+
+        pixel = _mm_blendv_epi8(pixel, color, visible);
+        _mm_storeu_si128((__m128i *) &line[x], pixel);
+    }
+}
+
+__attribute__((target("avx2")))
+void PPU::compositeAVX2(u16 *line, u16 backdrop)
+{
+    __m256i const transparent = _mm256_set1_epi16(TRANSPARENT);
+    __m256i const obj_bit     = _mm256_set1_epi16(1 << LAYER_OBJ);
+
+    for (int x = 0; x < SCREEN_WIDTH; x += 16)
+    {
+        __m256i mask     = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i const *) &layer_mask[x]));
+        __m256i pixel    = _mm256_set1_epi16(backdrop);
+        __m256i priority = _mm256_set1_epi16(4);
+
+        for (int bg : bg_list)
+        {
+            __m256i color = _mm256_loadu_si256((__m256i const *) &bg_buffer[bg][x]);
+            __m256i bit   = _mm256_set1_epi16(1 << bg);
+
+            // in the window and opaque
+            __m256i visible = _mm256_andnot_si256(_mm256_cmpeq_epi16(color, transparent), _mm256_cmpeq_epi16(_mm256_and_si256(mask, bit), bit));
+
+            pixel    = _mm256_blendv_epi8(pixel, color, visible);
+            priority = _mm256_blendv_epi8(priority, _mm256_set1_epi16(stat->bgcnt[bg].priority), visible);
+        }
+
+        __m256i color = _mm256_loadu_si256((__m256i const *) &obj_color[x]);
+        __m256i above = _mm256_cmpgt_epi16(_mm256_loadu_si256((__m256i const *) &obj_priority[x]), priority);
+
+        // in the window, opaque and not below the bg
+        __m256i visible = _mm256_cmpeq_epi16(_mm256_and_si256(mask, obj_bit), obj_bit);
+        visible = _mm256_andnot_si256(_mm256_or_si256(above, _mm256_cmpeq_epi16(color, transparent)), visible);
+
+        pixel = _mm256_blendv_epi8(pixel, color, visible);
+        _mm256_storeu_si256((__m256i *) &line[x], pixel);
+    }
+}
+#endif
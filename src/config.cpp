@@ -7,6 +7,7 @@
  * DESCRIPTION: global configuration data for discovery
  */
 
+#include <charconv>
 #include <fstream>
 #include <regex>
 #include <vector>
@@ -70,6 +71,11 @@ namespace config
     std::string bios_name = "gba_bios.bin";
     bool show_help = false;
     bool debug = false;
+    bool cached_interpreter = false;
+    bool jit = false;
+    bool fastmem = false;
+    bool idle_loop_skip = true;
+    std::map<std::string, u32> idle_loops;
 
     // default config file
     std::string config_file = "discovery.config";
@@ -123,6 +129,28 @@ void config::read_config_file()
         for(auto it = config.begin(); it != config.end(); it++)
         {
             std::string key = it->first, val = it->second;
+
+            // idle_loop_<game code> = <address of the branch closing the idle loop> or none
+            if (key.rfind("idle_loop_", 0) == 0)
+            {
+                // a hex address, with or without 0x
+                std::string_view hex = val;
+                if (hex.rfind("0x", 0) == 0 || hex.rfind("0X", 0) == 0)
+                    hex.remove_prefix(2);
+
+                u32 address;
+                auto [end, error] = std::from_chars(hex.data(), hex.data() + hex.size(), address, 16);
+
+                if (val == "none")
+                    idle_loops[key.substr(10)] = IDLE_LOOP_NONE;
+                else if (error == std::errc() && end == hex.data() + hex.size())
+                    idle_loops[key.substr(10)] = address;
+                else
+                    log(LogLevel::Warning, "Ignoring {}, {} is not an address\n", key, val);
+
+                continue;
+            }
+
             auto keymap_code = KeyboardInput.find(val);
             if(keymap_code != KeyboardInput.end())
             {
@@ -44,7 +44,18 @@ int main(int argc, char **argv)
     // load bios, rom, and launch game loop
     emulator.mem->loadBios(config::bios_name);
     emulator.mem->loadRom(config::rom_name);
-    
+
+    // fastmem maps the ROM buffer, so it waits until the ROM is loaded
+    if (config::fastmem && !emulator.cpu->enableFastmem())
+        log(LogLevel::Warning, "Fastmem needs an x86-64 Linux host, using the page tables instead\n");
+
+    // idle loop skipping, the config file can override it per game
+    auto idle_loop = config::idle_loops.find(emulator.mem->gameCode());
+
+    if (!config::idle_loop_skip)
+        emulator.cpu->idle_loops.setOverride(IDLE_LOOP_NONE);
+    else if (idle_loop != config::idle_loops.end())
+        emulator.cpu->idle_loops.setOverride(idle_loop->second);
 
     bool running = true;
     SDL_Event e;
@@ -6,26 +6,28 @@
  * DATE: October 8th, 2020
  * DESCRIPTION: execution of thumb instructions
  */
+#include <utility>
+
 #include "Arm7.h"
 
+template <u8 shift_type, u8 offset5>
 void Arm7::moveShiftedRegister(u16 instruction)
 {
-    u16 Rs         = util::bitseq<5, 3>(instruction);
-    u16 Rd         = util::bitseq<2, 0>(instruction); 
-    u32 offset5    = util::bitseq<10, 6>(instruction); // 5 bit immediate offset
-    u16 shift_type = util::bitseq<12, 11>(instruction);
-    u32 op1 = getRegister(Rs);
+    u16 Rs    = util::bitseq<5, 3>(instruction);
+    u16 Rd    = util::bitseq<2, 0>(instruction); 
+    u32 shift = offset5; // 5 bit immediate offset
+    u32 op1   = getRegister(Rs);
 
     // encodings of LSR #0, ASR #0, and ROR #0 should be interpreted as #LSR #2, ASR #32, and ROR #32
-    if (offset5 == 0 && shift_type != 0) // shift_type == 0 is LSL
+    if constexpr (offset5 == 0 && shift_type != 0) // shift_type == 0 is LSL
     {
         if (shift_type == 0b11) // rotate right extended
-            offset5 = 0xFFFFFFFF;
+            shift = 0xFFFFFFFF;
         else // LSR #32 or ASR #32
-            offset5 = 32;
+            shift = 32;
     }
 
-    u8 carry_out = barrelShift(offset5, op1, shift_type);
+    u8 carry_out = barrelShift(shift, op1, shift_type);
     setRegister(Rd, op1);
     updateFlagsLogical(op1, carry_out);
 
@@ -33,23 +35,21 @@ void Arm7::moveShiftedRegister(u16 instruction)
     tick(0, 1, 0);
 }
 
+template <bool immediate, bool subtract, u8 Rn_offset3>
 void Arm7::addSubtract(u16 instruction)
 {
-    u16 Rs         = util::bitseq<5, 3>(instruction);
-    u16 Rd         = util::bitseq<2, 0>(instruction);
-    u16 Rn_offset3 = util::bitseq<8, 6>(instruction);
-    bool immediate = util::bitseq<10, 10>(instruction) == 1;
-    bool add       = util::bitseq<9, 9>(instruction) == 0;
+    u16 Rs = util::bitseq<5, 3>(instruction);
+    u16 Rd = util::bitseq<2, 0>(instruction);
     u32 op1, op2, result;
 
     op1 = getRegister(Rs);
 
-    if (immediate)
+    if constexpr (immediate)
         op2 = Rn_offset3;
     else
         op2 = getRegister(Rn_offset3);
 
-    if (add)
+    if constexpr (!subtract)
     {
         result = op1 + op2;
         updateFlagsAddition(op1, op2, result);
@@ -67,11 +67,10 @@ void Arm7::addSubtract(u16 instruction)
     tick(0, 1, 0);
 }
 
+template <u8 opcode, u8 Rd>
 void Arm7::moveImmediate(u16 instruction)
 {
     u16 offset8 = util::bitseq<7, 0>(instruction);
-    u16 Rd      = util::bitseq<10, 8>(instruction);
-    u16 opcode  = util::bitseq<12, 11>(instruction);
     u32 result;
     u8 carry = getConditionCodeFlag(ConditionFlag::C);
     u32 operand = getRegister(Rd);
@@ -103,11 +102,11 @@ void Arm7::moveImmediate(u16 instruction)
     tick(0, 1, 0);
 }
 
+template <u8 opcode>
 void Arm7::aluThumb(u16 instruction)
 {
     u16 Rs     = util::bitseq<5, 3>(instruction);
     u16 Rd     = util::bitseq<2, 0>(instruction); 
-    u16 opcode = util::bitseq<9, 6>(instruction);
     u32 op1    = getRegister(Rs);
     u32 op2    = getRegister(Rd);
     u8 carry   = getConditionCodeFlag(ConditionFlag::C);
@@ -241,18 +240,16 @@ void Arm7::aluThumb(u16 instruction)
     tick(n, s, i);
 }
 
+// H1 and H2 are the hi operand flags for Rd and Rs
+template <u8 opcode, bool H1, bool H2>
 void Arm7::hiRegisterOps(u16 instruction)
 {
-    u16 Rs     = util::bitseq<5, 3>(instruction);
-    u16 Rd     = util::bitseq<2, 0>(instruction); 
-    u16 opcode = util::bitseq<9, 8>(instruction);
-
-    bool H1 = util::bitseq<7, 7>(instruction) == 0x1; // Hi operand flag 1
-    bool H2 = util::bitseq<6, 6>(instruction) == 0x1; // Hi operand flag 2
+    u16 Rs = util::bitseq<5, 3>(instruction);
+    u16 Rd = util::bitseq<2, 0>(instruction); 
 
     // access hi registers (need a 4th bit)
-    if (H2) Rs |= 0b1000;
-    if (H1) Rd |= 0b1000;
+    if constexpr (H2) Rs |= 0b1000;
+    if constexpr (H1) Rd |= 0b1000;
 
     u32 op1 = getRegister(Rs);
     u32 op2 = getRegister(Rd);
@@ -362,9 +359,9 @@ void Arm7::hiRegisterOps(u16 instruction)
     tick(n, s, i);
 }
 
+template <u8 Rd>
 void Arm7::pcRelLoad(u16 instruction)
 {
-    u16 Rd = util::bitseq<10, 8>(instruction); 
     u16 word8 = util::bitseq<7, 0>(instruction);
     u32 base = getRegister(r15);
     base &= ~2; // clear bit 1 for word alignment
@@ -374,19 +371,18 @@ void Arm7::pcRelLoad(u16 instruction)
 
     setRegister(Rd, read32(base, true));
     
-    // cycles: 1S + 1N + 1I
-    tick(1, 1, 1);
+    // cycles: 1S + 1N + 1I, the 1N is the data access
+    tickData(base, true, 1, 0);
+    tick(0, 1, 1);
 }
 
+// Ro is the offset register
+template <bool load, bool byte, u8 Ro>
 void Arm7::loadStoreRegOffset(u16 instruction)
 {
-    u16 Ro = util::bitseq<8, 6>(instruction); // offset register
     u16 Rb = util::bitseq<5, 3>(instruction); // base register
     u16 Rd = util::bitseq<2, 0>(instruction); // destination register
 
-    bool load = util::bitseq<11, 11>(instruction) == 1;
-    bool byte = util::bitseq<10, 10>(instruction) == 1;
-
     u32 base = getRegister(Rb);
     base += getRegister(Ro); // add offset to base
 
@@ -395,14 +391,13 @@ void Arm7::loadStoreRegOffset(u16 instruction)
     u8 s = 0;
     u8 i = 0;
 
-    if (load)
+    if constexpr (load)
     {
-        if (byte)
+        if constexpr (byte)
             setRegister(Rd, read8(base));
         else
             setRegister(Rd, read32(base, true));
         
-        n = 1;
         s = 1;
         i = 1;
     }
@@ -410,29 +405,29 @@ void Arm7::loadStoreRegOffset(u16 instruction)
     // store
     else
     {
-        if (byte)
+        if constexpr (byte)
             write8(base, getRegister(Rd) & 0xFF);
         else
             write32(base, getRegister(Rd));
 
-        n = 2;    
+        n = 1;
     }
 
     // cycles:
     // 1S + 1N + 1I for LDR
     // 2N for STR
+    // one N is the data access
+    tickData(base, !byte, 1, 0);
     tick(n, s, i);
 }
 
+// H is the halfword flag, S the sign extended flag, Ro the offset register
+template <bool H, bool S, u8 Ro>
 void Arm7::loadStoreSignedHalfword(u16 instruction)
 {
-    u16 Ro = util::bitseq<8, 6>(instruction); // offset register
     u16 Rb = util::bitseq<5, 3>(instruction); // base register
     u16 Rd = util::bitseq<2, 0>(instruction); // destination register
 
-    bool H = util::bitseq<11, 11>(instruction) == 1; // H flag
-    bool S = util::bitseq<10, 10>(instruction) == 1; // sign extended flag
-
     u32 base = getRegister(Rb);
     base += getRegister(Ro); // add offset to base
 
@@ -442,30 +437,28 @@ void Arm7::loadStoreSignedHalfword(u16 instruction)
     u8 i = 0;
 
     // store halfword
-    if (!S && !H)
+    if constexpr (!S && !H)
     {
         write16(base, getRegister(Rd) & 0xFFFF);
-        n = 2;
+        n = 1;
     }
     
     // load halfword
-    else if (!S && H)
+    else if constexpr (!S && H)
     {
         u32 value = read16(base);
         setRegister(Rd, value);
-        n = 1;
         s = 1;
         i = 1;
     }
     
     // load sign-extended byte
-    else if (S && !H)
+    else if constexpr (S && !H)
     {
         u32 value = read8(base);
         if (value & 0x80)
             value |= 0xFFFFFF00; // bit 7 of byte is 1, so sign extend bits 31-8 of register
         setRegister(Rd, value);
-        n = 1;
         s = 1;
         i = 1;
     }
@@ -475,7 +468,6 @@ void Arm7::loadStoreSignedHalfword(u16 instruction)
     {
         u32 value = read16(base, true);
         setRegister(Rd, value);
-        n = 1;
         s = 1;
         i = 1;
     }
@@ -483,56 +475,54 @@ void Arm7::loadStoreSignedHalfword(u16 instruction)
     // cycles:
     // 1S + 1N + 1I for LDR
     // 2N for STR
+    // one N is the data access
+    tickData(base, false, 1, 0);
     tick(n, s, i);
 }
 
+// offset5 is the 5 bit immediate offset
+template <bool byte, bool load, u8 offset5>
 void Arm7::loadStoreImmediate(u16 instruction)
 {
-    u16 Rb      = util::bitseq<5, 3>(instruction);  // base register
-    u16 Rd      = util::bitseq<2, 0>(instruction);  // destination register
-    u16 offset5 = util::bitseq<10, 6>(instruction); // 5 bit immediate offset
-
-    bool byte = util::bitseq<12, 12>(instruction) == 1;
-    bool load = util::bitseq<11, 11>(instruction) == 1;
+    u16 Rb = util::bitseq<5, 3>(instruction);  // base register
+    u16 Rd = util::bitseq<2, 0>(instruction);  // destination register
     
     // cycles
     u8 n = 0;
     u8 s = 0;
     u8 i = 0;
 
-    if (!byte)
-        offset5 <<= 2; // assembler places #imm >> 2 in word5 for word accesses
+    // assembler places #imm >> 2 in word5 for word accesses
+    constexpr u32 offset = byte ? offset5 : offset5 << 2;
 
     u32 base = getRegister(Rb);
-    base += offset5; // add offset to base
+    base += offset; // add offset to base
 
     // store word
-    if (!load && !byte)
+    if constexpr (!load && !byte)
     { 
         write32(base, getRegister(Rd));
-        n = 2;
+        n = 1;
     }
     
     // load word
-    else if (load && !byte)
+    else if constexpr (load && !byte)
     {
         setRegister(Rd,  read32(base, true));
-        n = 1;
         s = 1;
         i = 1;
     }
     
     // store byte
-    else if (!load && byte)
+    else if constexpr (!load && byte)
     {
         write8(base, getRegister(Rd) & 0xFF);
-        n = 2;
+        n = 1;
     }
     
     else
     { // load byte
         setRegister(Rd, read8(base));
-        n = 1;
         s = 1;
         i = 1;
     }
@@ -540,17 +530,19 @@ void Arm7::loadStoreImmediate(u16 instruction)
     // cycles:
     // 1S + 1N + 1I for LDR
     // 2N for STR
+    // one N is the data access
+    tickData(base, !byte, 1, 0);
     tick(n, s, i);
 }
 
+// offset5 is the 5 bit immediate offset
+template <bool load, u8 offset5>
 void Arm7::loadStoreHalfword(u16 instruction)
 {
-    u16 Rb      = util::bitseq<5, 3>(instruction);  // base register
-    u16 Rd      = util::bitseq<2, 0>(instruction);  // destination register
-    u16 offset5 = util::bitseq<10, 6>(instruction); // 5 bit immediate offset
+    u16 Rb = util::bitseq<5, 3>(instruction);  // base register
+    u16 Rd = util::bitseq<2, 0>(instruction);  // destination register
 
-    offset5 <<= 1; // assembler places #imm >> 1 in word5 to ensure halfword alignment
-    bool load = util::bitseq<11, 11>(instruction) == 1;
+    constexpr u32 offset = offset5 << 1; // assembler places #imm >> 1 in word5 to ensure halfword alignment
 
     // cycles
     u8 n = 0;
@@ -558,12 +550,11 @@ void Arm7::loadStoreHalfword(u16 instruction)
     u8 i = 0;
 
     u32 base = getRegister(Rb);
-    base += offset5; // add offset to base
+    base += offset; // add offset to base
 
-    if (load)
+    if constexpr (load)
     {
         setRegister(Rd, read16(base));
-        n = 1;
         s = 1;
         i = 1;
     }
@@ -572,20 +563,22 @@ void Arm7::loadStoreHalfword(u16 instruction)
     else
     {
         write16(base, getRegister(Rd) & 0xFFFF);
-        n = 2;
+        n = 1;
     }
 
     // cycles:
     // 1S + 1N + 1I for LDR
     // 2N for STR
+    // one N is the data access
+    tickData(base, false, 1, 0);
     tick(n, s, i);
 }
 
+// Rd is the destination register
+template <bool load, u8 Rd>
 void Arm7::spRelLoadStore(u16 instruction)
 {
-    u16 Rd    = util::bitseq<10, 8>(instruction); // destination register
     u16 word8 = util::bitseq<7, 0>(instruction);  // 8 bit immediate offset
-    bool load = util::bitseq<11, 11>(instruction) == 1;
 
     // cycles
     u8 n = 0;
@@ -597,10 +590,9 @@ void Arm7::spRelLoadStore(u16 instruction)
     u32 base = getRegister(r13); // current stack pointer is base address
     base += word8; // add offset to base
 
-    if (load)
+    if constexpr (load)
     {
         setRegister(Rd, read32(base, true));
-        n = 1;
         s = 1;
         i = 1;
     }
@@ -609,25 +601,27 @@ void Arm7::spRelLoadStore(u16 instruction)
     else
     {
         write32(base, getRegister(Rd));
-        n = 2;
+        n = 1;
     }
 
     // cycles:
     // 1S + 1N + 1I for LDR
     // 2N for STR
+    // one N is the data access
+    tickData(base, true, 1, 0);
     tick(n, s, i);
 }
 
+// sp selects the stack pointer as base if true, else PC; Rd is the destination register
+template <bool sp, u8 Rd>
 void Arm7::loadAddress(u16 instruction)
 {
-    u16 Rd    = util::bitseq<10, 8>(instruction);       // destination register
-    u16 word8 = util::bitseq<7, 0>(instruction);        // 8 bit immediate offset
-    bool sp   = util::bitseq<11, 11>(instruction) == 1; // stack pointer if true, else PC
+    u16 word8 = util::bitseq<7, 0>(instruction); // 8 bit immediate offset
     u32 base;
 
     word8 <<= 2; // assembler places #imm >> 2 in word8 to ensure word alignment
 
-    if (sp)
+    if constexpr (sp)
     {
         base = getRegister(r13);
     }
@@ -647,16 +641,17 @@ void Arm7::loadAddress(u16 instruction)
     tick(0, 1, 0);
 }
 
+// negative is the sign bit of sword8
+template <bool negative>
 void Arm7::addOffsetToSp(u16 instruction)
 {
     u16 sword8 = util::bitseq<6, 0>(instruction); // 7 bit signed immediate value
-    bool positive = util::bitseq<7, 7>(instruction) == 0; // sign bit of sword8
 
     sword8 <<= 2; // assembler places #imm >> 2 in word8 to ensure word alignment
 
     u32 base = getRegister(r13); // base address at SP
 
-    if (positive)
+    if constexpr (!negative)
         base += sword8;
     else
         base -= sword8;
@@ -667,11 +662,11 @@ void Arm7::addOffsetToSp(u16 instruction)
     tick(0, 1, 0);
 }
 
+// R is the PC/LR bit
+template <bool load, bool R>
 void Arm7::pushPop(u16 instruction)
 {
-    bool load = util::bitseq<11, 11>(instruction) == 1;
-    bool R    = util::bitseq<8, 8>(instruction) == 1; // PC/LR bit
-    u32 base  = getRegister(r13); // base address at SP
+    u32 base = getRegister(r13); // base address at SP
 
     int num_registers = 0; // number of set bits in the register list, should be between 0-8
     int set_registers[8];
@@ -712,12 +707,12 @@ void Arm7::pushPop(u16 instruction)
     //     return;
     // }
 
-    if (!load) // PUSH Rlist
+    if constexpr (!load) // PUSH Rlist
     {
-        n = 2;
+        n = 1;
         // get final sp value
         base -= 4 * num_registers;
-        if (R)
+        if constexpr (R)
             base -= 4;
 
         // write base back into sp
@@ -728,29 +723,26 @@ void Arm7::pushPop(u16 instruction)
         {
             write32(base, getRegister(set_registers[i]));
             base += 4; // increment stack pointer (4 bytes for word alignment)
-            ++s;
         }
 
-        if (R) // push LR
+        if constexpr (R) // push LR
         {
             write32(base, getRegister(r14));
             // base -= 4; // increment stack pointer (4 bytes for word alignment)
-            ++s;
         }
     }
     
     else // POP Rlist
     {
-        n = 1;
+        s = 1;
         i = 1;
         for (int i = 0; i < num_registers; ++i)
         {
             setRegister(set_registers[i], read32(base));
             base += 4; // decrement stack pointer (4 bytes for word alignment)
-            ++s;
         }
 
-        if (R) // pop pc
+        if constexpr (R) // pop pc
         {
             setRegister(r15, read32(base) & ~1); // guaruntee halfword alignment
             pipeline_full = false;
@@ -767,14 +759,17 @@ void Arm7::pushPop(u16 instruction)
     // nS + 1N + 1I (POP)
     // (n + 1)S + 2N + 1I (POP PC)
     // (n-1)S + 2N (PUSH).
+    // the words take 1N + (n-1)S of them, from the lowest address, which is the new sp of a push
+    if (int words = num_registers + R)
+        tickData(load ? base - 4 * words : getRegister(r13), true, 1, words - 1);
     tick(n, s, i);
 }
 
+// Rb is the base register
+template <bool load, u8 Rb>
 void Arm7::multipleLoadStore(u16 instruction)
 {
-    u16 Rb    = util::bitseq<10, 8>(instruction); // base register
-    bool load = util::bitseq<11, 11>(instruction) == 1;
-    u32 base  = getRegister(Rb);
+    u32 base = getRegister(Rb);
 
     // cycles
     u8 n = 0;
@@ -797,7 +792,7 @@ void Arm7::multipleLoadStore(u16 instruction)
     // empty Rlist, Rb = Rb + 0x40
     if (num_registers == 0)
     {
-        if (load) // load r15
+        if constexpr (load) // load r15
         { 
             setRegister(r15, read32(base));
             pipeline_full = false;
@@ -805,7 +800,7 @@ void Arm7::multipleLoadStore(u16 instruction)
 
         else // store r15
         {
-            write32(base, registers.r15 + 4);
+            write32(base, registers.r[15] + 4);
         }
 
         // store Rb = Rb +/- 0x40
@@ -814,16 +809,15 @@ void Arm7::multipleLoadStore(u16 instruction)
         return;
     }
 
-    if (load)
+    if constexpr (load)
     { 
         for (int i = 0; i < num_registers; ++i)
         {
             setRegister(set_registers[i], read32(base));
             base += 4; // decrement stack pointer (4 bytes for word alignment)
-            ++s;
         }
 
-        ++n;
+        ++s;
         ++i;
     }
     
@@ -833,10 +827,9 @@ void Arm7::multipleLoadStore(u16 instruction)
         {
             write32(base, getRegister(set_registers[i]));
             base += 4; // increment stack pointer (4 bytes for word alignment)
-            ++s;
         }
 
-        n = 2;
+        n = 1;
     }
 
     // write back address into Rb
@@ -845,16 +838,18 @@ void Arm7::multipleLoadStore(u16 instruction)
     // cycles:
     // nS + 1N + 1I for LDM
     // (n - 1)S + 2N for STM
+    // the words take 1N + (n - 1)S of them, base is past the highest of them
+    tickData(base - 4 * num_registers, true, 1, num_registers - 1);
     tick(n, s, i);
 }
 
+template <u8 condition>
 void Arm7::conditionalBranch(u16 instruction)
 {
     u16 soffset8 = util::bitseq<7, 0>(instruction); // signed 8 bit offset
-    Condition condition = (Condition) util::bitseq<11, 8>(instruction);
     u32 base = getRegister(r15);
     u32 jump_address;
-    if (!conditionMet(condition))
+    if (!conditionMet((Condition) condition))
     {
         // 1S
         tick(0, 1, 0);
@@ -878,6 +873,7 @@ void Arm7::conditionalBranch(u16 instruction)
     }
 
     setRegister(r15, jump_address);
+    checkIdleLoop(jump_address);
 
     // flush pipeline for refill
     pipeline_full = false;
@@ -955,6 +951,7 @@ void Arm7::unconditionalBranch(u16 instruction)
     }
 
     setRegister(r15, jump_address);
+    checkIdleLoop(jump_address);
 
     // flush pipeline for refill
     pipeline_full = false;
@@ -963,13 +960,14 @@ void Arm7::unconditionalBranch(u16 instruction)
     tick(1, 2, 0);
 }
 
+// H is the high/low offset bit
+template <bool H>
 void Arm7::longBranchLink(u16 instruction)
 {
-    u32 offset = util::bitseq<10, 0>(instruction);       // long branch offset
-    bool H     = util::bitseq<11, 11>(instruction) == 1; // high/low offset bit
+    u32 offset = util::bitseq<10, 0>(instruction); // long branch offset
     u32 base;
 
-    if (H) // instruction 2
+    if constexpr (H) // instruction 2
     {
         base = getRegister(r14); // LR
         offset <<= 1;
@@ -1016,3 +1014,64 @@ void Arm7::longBranchLink(u16 instruction)
     }
 }
 
+void Arm7::undefinedThumb(u16 instruction)
+{
+    std::cerr << "Cannot execute thumb instruction: " << instruction << " " << std::hex << registers.r[15] << "\n";
+    registers.r[15] &= ~0x1;
+}
+
+/*
+ * Select the handler for a thumb instruction whose top 10 bits are i.
+ * Every field that lives in those bits becomes a template argument,
+ * so the handler only has to decode what is left in bits 5-0.
+ */
+template <u16 i>
+static constexpr Arm7::ThumbHandler thumbHandler()
+{
+    constexpr u16 instruction = i << 6;
+
+    // fields of the top 10 bits, by the bits they occupy in the instruction
+    constexpr bool X  = i >> 6 & 0x1;  // bit 12
+    constexpr u8 op2  = i >> 5 & 0x3;  // bits 12-11
+    constexpr bool L  = i >> 5 & 0x1;  // bit 11
+    constexpr u8 cond = i >> 2 & 0xF;  // bits 11-8
+    constexpr bool B  = i >> 4 & 0x1;  // bit 10
+    constexpr u8 Rd   = i >> 2 & 0x7;  // bits 10-8
+    constexpr u8 imm5 = i & 0x1F;      // bits 10-6
+    constexpr bool S  = i >> 3 & 0x1;  // bit 9
+    constexpr u8 op4  = i & 0xF;       // bits 9-6
+    constexpr u8 hop  = i >> 2 & 0x3;  // bits 9-8
+    constexpr bool R  = i >> 2 & 0x1;  // bit 8
+    constexpr u8 Ro   = i & 0x7;       // bits 8-6
+    constexpr bool H1 = i >> 1 & 0x1;  // bit 7
+    constexpr bool H2 = i & 0x1;       // bit 6
+
+    constexpr ThumbInstruction format = util::getInstructionFormat(instruction);
+
+    if constexpr (format == ThumbInstruction::MSR)         return &Arm7::moveShiftedRegister<op2, imm5>;
+    else if constexpr (format == ThumbInstruction::ADDSUB) return &Arm7::addSubtract<B, S, Ro>;
+    else if constexpr (format == ThumbInstruction::IMM)    return &Arm7::moveImmediate<op2, Rd>;
+    else if constexpr (format == ThumbInstruction::ALU)    return &Arm7::aluThumb<op4>;
+    else if constexpr (format == ThumbInstruction::HI)     return &Arm7::hiRegisterOps<hop, H1, H2>;
+    else if constexpr (format == ThumbInstruction::PC)     return &Arm7::pcRelLoad<Rd>;
+    else if constexpr (format == ThumbInstruction::MOV)    return &Arm7::loadStoreRegOffset<L, B, Ro>;
+    else if constexpr (format == ThumbInstruction::MOVS)   return &Arm7::loadStoreSignedHalfword<L, B, Ro>;
+    else if constexpr (format == ThumbInstruction::MOVI)   return &Arm7::loadStoreImmediate<X, L, imm5>;
+    else if constexpr (format == ThumbInstruction::MOVH)   return &Arm7::loadStoreHalfword<L, imm5>;
+    else if constexpr (format == ThumbInstruction::SP)     return &Arm7::spRelLoadStore<L, Rd>;
+    else if constexpr (format == ThumbInstruction::LDA)    return &Arm7::loadAddress<L, Rd>;
+    else if constexpr (format == ThumbInstruction::ADDSP)  return &Arm7::addOffsetToSp<H1>;
+    else if constexpr (format == ThumbInstruction::POP)    return &Arm7::pushPop<L, R>;
+    else if constexpr (format == ThumbInstruction::MOVM)   return &Arm7::multipleLoadStore<L, Rd>;
+    else if constexpr (format == ThumbInstruction::B)      return &Arm7::conditionalBranch<cond>;
+    else if constexpr (format == ThumbInstruction::SWI)    return &Arm7::softwareInterruptThumb;
+    else if constexpr (format == ThumbInstruction::BAL)    return &Arm7::unconditionalBranch;
+    else if constexpr (format == ThumbInstruction::BL)     return &Arm7::longBranchLink<L>;
+    else                                                   return &Arm7::undefinedThumb;
+}
+
+// build the thumb handler table at compile time, indexed by the top 10 bits of an instruction
+const std::array<Arm7::ThumbHandler, 1024> Arm7::thumb_lut = []<std::size_t... i>(std::index_sequence<i...>) constexpr
+{
+    return std::array<ThumbHandler, 1024> { thumbHandler<i>()... };
+}(std::make_index_sequence<1024>());